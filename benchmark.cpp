@@ -0,0 +1,380 @@
+/*
+  benchmark.cpp
+
+  Micro benchmarks of Print formatting, String operations and the
+  OutputPrint sinks, next to printf(), iostream and std::string
+  baselines.  Results are written to "stdout" as JSON:
+
+    {"benchmarks": [
+      {"group": "...", "name": "...", "iterations": N,
+       "ns_per_op": ..., "bytes_per_second": ..., "allocs_per_op": ...},
+      ...
+    ]}
+
+  "allocs_per_op" counts String heap buffer allocations and resizes,
+  and the calls to the global operator new (std::string, ostringstream,
+  ofstream, ...), so the baselines are counted too.  Allocations made
+  with malloc() inside the C library (printf(), stdio buffers) are not.
+
+  Usage: benchmark [--min-time=MILLISECONDS] [FILTER]
+  Only benchmarks whose group or name contains FILTER are run.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+  License GNU Lesser General Public License v3.0.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <thread>
+#define NULL_DEVICE "/dev/null"
+#else
+#define NULL_DEVICE "NUL"
+#endif
+
+#include "src/OutputPrint.h"
+
+/* Counts the allocations of the C++ library, the String buffers are
+   counted by CountingAllocator below */
+static std::atomic<unsigned long> new_calls(0);
+
+static void *countedNew(size_t size)
+{
+  new_calls.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new(size_t size) { return countedNew(size); }
+void *operator new[](size_t size) { return countedNew(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  new_calls.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size ? size : 1);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  new_calls.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size ? size : 1);
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+/* Counts the String buffer allocations, forwarding to malloc() */
+class CountingAllocator : public StringAllocator
+{
+  public:
+    unsigned long count;
+
+    CountingAllocator() : count(0) {}
+    void *allocate(size_t size) {
+      count++;
+      return StringAllocator::heap().allocate(size);
+    }
+    void *reallocate(void *block, size_t oldSize, size_t newSize) {
+      count++;
+      return StringAllocator::heap().reallocate(block, oldSize, newSize);
+    }
+    void deallocate(void *block, size_t size) {
+      StringAllocator::heap().deallocate(block, size);
+    }
+};
+
+/* Discards the output, to measure formatting alone */
+class NullPrint : public Print
+{
+  public:
+    using Print::write;
+    size_t write(uint8_t) { return 1; }
+    size_t write(const uint8_t *, size_t size) { return size; }
+};
+
+static CountingAllocator allocations;
+static OutputPrint Out;
+static double min_time = 0.2;     // seconds per benchmark
+static const char *filter = NULL;
+static bool first_result = true;
+static volatile size_t sink;      // keeps results alive
+
+static unsigned long allocationCount()
+{
+  return allocations.count + new_calls.load(std::memory_order_relaxed);
+}
+
+static double now()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static size_t digits(unsigned long n)
+{
+  size_t count = 1;
+  while (n >= 10) { n /= 10; count++; }
+  return count;
+}
+
+/* Runs op(i), which returns the bytes it produced, for growing batches
+   until a batch lasts min_time, and reports the last batch */
+template <class Op>
+static void bench(const char *group, const char *name, Op op)
+{
+  if (filter && !strstr(group, filter) && !strstr(name, filter)) return;
+
+  unsigned long iterations = 1;
+  double elapsed = 0;
+  size_t bytes = 0;
+  unsigned long allocs = 0;
+  for (;;) {
+    bytes = 0;
+    unsigned long start_allocs = allocationCount();
+    double start = now();
+    for (unsigned long i = 0; i < iterations; i++) bytes += op(i);
+    elapsed = now() - start;
+    allocs = allocationCount() - start_allocs;
+    if (elapsed >= min_time || iterations >= 1UL << 30) break;
+    // aim a little past min_time, growing at least 2x and at most 100x
+    double scale = elapsed > 0 ? min_time * 1.2 / elapsed : 100;
+    scale = std::min(std::max(scale, 2.0), 100.0);
+    iterations = (unsigned long)((double)iterations * scale);
+  }
+  sink = sink + bytes;
+
+  // Print::print(double) is limited to 32 bit values, so snprintf()
+  char record[512];
+  double ns_per_op = elapsed * 1e9 / (double)iterations;
+  snprintf(record, sizeof(record),
+    "%s  {\"group\": \"%s\", \"name\": \"%s\", \"iterations\": %lu, "
+    "\"ns_per_op\": %.2f, \"bytes_per_second\": %.0f, \"allocs_per_op\": %.3f}",
+    first_result ? "\n" : ",\n", group, name, iterations,
+    ns_per_op, elapsed > 0 ? (double)bytes / elapsed : 0.0, (double)allocs / (double)iterations);
+  first_result = false;
+  Out.print(record);
+  Out.flush();
+  fprintf(stderr, "%-10s %-40s %12.2f ns/op\n", group, name, ns_per_op);
+}
+
+/* Print formatting against snprintf() and ostringstream */
+static void benchFormatting()
+{
+  NullPrint null;
+  char buf[64];
+  std::ostringstream os;
+
+  bench("format", "Print unsigned long DEC", [&](unsigned long i) { return null.print(i * 2654435761UL, DEC); });
+  bench("format", "Print unsigned long HEX", [&](unsigned long i) { return null.print(i * 2654435761UL, HEX); });
+  bench("format", "Print unsigned long OCT", [&](unsigned long i) { return null.print(i * 2654435761UL, OCT); });
+  bench("format", "Print unsigned long BIN", [&](unsigned long i) { return null.print(i * 2654435761UL, BIN); });
+  bench("format", "Print long negative DEC", [&](unsigned long i) { return null.print(-(long)(i * 40503UL), DEC); });
+  bench("format", "Print double 2 digits", [&](unsigned long i) { return null.print((double)i * 1.37, 2); });
+  bench("format", "Print double 6 digits", [&](unsigned long i) { return null.print((double)i * 1.37, 6); });
+
+  bench("format", "snprintf %lu", [&](unsigned long i) { return (size_t)snprintf(buf, sizeof(buf), "%lu", i * 2654435761UL); });
+  bench("format", "snprintf %lX", [&](unsigned long i) { return (size_t)snprintf(buf, sizeof(buf), "%lX", i * 2654435761UL); });
+  bench("format", "snprintf %lo", [&](unsigned long i) { return (size_t)snprintf(buf, sizeof(buf), "%lo", i * 2654435761UL); });
+  bench("format", "snprintf %.2f", [&](unsigned long i) { return (size_t)snprintf(buf, sizeof(buf), "%.2f", (double)i * 1.37); });
+  bench("format", "snprintf %.6f", [&](unsigned long i) { return (size_t)snprintf(buf, sizeof(buf), "%.6f", (double)i * 1.37); });
+
+  bench("format", "ostringstream unsigned long dec", [&](unsigned long i) {
+    os.str(""); os << std::dec << i * 2654435761UL; return (size_t)os.tellp();
+  });
+  bench("format", "ostringstream unsigned long hex", [&](unsigned long i) {
+    os.str(""); os << std::hex << i * 2654435761UL; return (size_t)os.tellp();
+  });
+  bench("format", "ostringstream double", [&](unsigned long i) {
+    os.str(""); os << (double)i * 1.37; return (size_t)os.tellp();
+  });
+}
+
+/* String operations at several sizes against std::string */
+static void benchStrings(size_t size)
+{
+  char name[64];
+  const char piece[] = "0123456789abcdef";
+
+  String text;
+  std::string stdtext;
+  while (text.length() < size) {
+    text += piece;
+    stdtext += piece;
+  }
+  text += "needle!";
+  stdtext += "needle!";
+  String needle("needle!"), from("ab"), to("cd");
+
+  snprintf(name, sizeof(name), "String concat %lu bytes", (unsigned long)size);
+  bench("string", name, [&](unsigned long) {
+    String s;
+    while (s.length() < size) s += piece;
+    return s.length();
+  });
+  snprintf(name, sizeof(name), "std::string append %lu bytes", (unsigned long)size);
+  bench("string", name, [&](unsigned long) {
+    std::string s;
+    while (s.length() < size) s += piece;
+    return s.length();
+  });
+
+  snprintf(name, sizeof(name), "String indexOf %lu bytes", (unsigned long)size);
+  bench("string", name, [&](unsigned long) { return (size_t)text.indexOf(needle); });
+  snprintf(name, sizeof(name), "std::string find %lu bytes", (unsigned long)size);
+  bench("string", name, [&](unsigned long) { return stdtext.find("needle!"); });
+
+  // swaps "ab" and "cd" back and forth, so the length does not change
+  snprintf(name, sizeof(name), "String replace %lu bytes", (unsigned long)size);
+  bench("string", name, [&](unsigned long i) {
+    if (i & 1) text.replace(to, from); else text.replace(from, to);
+    return text.length();
+  });
+  snprintf(name, sizeof(name), "std::string replace %lu bytes", (unsigned long)size);
+  bench("string", name, [&](unsigned long i) {
+    const char *f = (i & 1) ? "cd" : "ab";
+    const char *t = (i & 1) ? "ab" : "cd";
+    for (size_t pos = stdtext.find(f); pos != std::string::npos; pos = stdtext.find(f, pos + 2))
+      stdtext.replace(pos, 2, t);
+    return stdtext.length();
+  });
+
+  snprintf(name, sizeof(name), "String toUpperCase %lu bytes", (unsigned long)size);
+  bench("string", name, [&](unsigned long i) {
+    if (i & 1) text.toLowerCase(); else text.toUpperCase();
+    return text.length();
+  });
+  snprintf(name, sizeof(name), "std::string toupper %lu bytes", (unsigned long)size);
+  bench("string", name, [&](unsigned long i) {
+    if (i & 1) std::transform(stdtext.begin(), stdtext.end(), stdtext.begin(), ::tolower);
+    else std::transform(stdtext.begin(), stdtext.end(), stdtext.begin(), ::toupper);
+    return stdtext.length();
+  });
+}
+
+/* OutputPrint writing lines to a FILE* against fprintf() */
+static void benchSink(const char *target, FILE *file)
+{
+  char name[64];
+  OutputPrint output(file);
+  String line("The quick brown fox jumps over the lazy dog, 0123456789");
+
+  snprintf(name, sizeof(name), "OutputPrint println(String) %s", target);
+  bench("sink", name, [&](unsigned long) { return output.println(line); });
+  snprintf(name, sizeof(name), "OutputPrint println(int) %s", target);
+  bench("sink", name, [&](unsigned long i) { return output.println((int)i); });
+  snprintf(name, sizeof(name), "fprintf %%s %s", target);
+  bench("sink", name, [&](unsigned long) { return (size_t)fprintf(file, "%s\r\n", line.c_str()); });
+  snprintf(name, sizeof(name), "fprintf %%d %s", target);
+  bench("sink", name, [&](unsigned long i) { return (size_t)fprintf(file, "%d\r\n", (int)i); });
+  output.flush();
+}
+
+/* std::ofstream baseline of benchSink() */
+static void benchStreamSink(const char *target, const char *path)
+{
+  char name[64];
+  std::ofstream os(path, std::ios::out | std::ios::binary);
+  if (!os) return;
+  std::string line("The quick brown fox jumps over the lazy dog, 0123456789");
+
+  snprintf(name, sizeof(name), "ofstream << string %s", target);
+  bench("sink", name, [&](unsigned long) { os << line << "\r\n"; return line.length() + 2; });
+  snprintf(name, sizeof(name), "ofstream << int %s", target);
+  bench("sink", name, [&](unsigned long i) { os << (int)i << "\r\n"; return digits(i) + 2; });
+}
+
+#ifndef _WIN32
+/* Calls write(fd) with the write end of a pipe, which write() closes,
+   while a thread drains the read end, as a consumer process would */
+template <class Write>
+static void withPipe(Write write)
+{
+  int fds[2];
+  if (pipe(fds) != 0) return;
+  std::thread reader([fds]() {
+    char buf[65536];
+    while (read(fds[0], buf, sizeof(buf)) > 0) {}
+    close(fds[0]);
+  });
+  write(fds[1]);
+  reader.join();
+}
+#endif
+
+static void benchSinks()
+{
+  FILE *devnull = fopen(NULL_DEVICE, "wb");
+  if (devnull) {
+    benchSink("to " NULL_DEVICE, devnull);
+    fclose(devnull);
+  }
+  benchStreamSink("to " NULL_DEVICE, NULL_DEVICE);
+
+  FILE *file = tmpfile();
+  if (file) {
+    benchSink("to file", file);
+    fclose(file);
+  }
+#ifndef _WIN32
+  char path[] = "/tmp/benchmark-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd >= 0) {
+    close(fd);
+    benchStreamSink("to file", path);
+    remove(path);
+  }
+#else
+  char path[L_tmpnam];
+  if (tmpnam(path)) {
+    benchStreamSink("to file", path);
+    remove(path);
+  }
+#endif
+
+#ifndef _WIN32
+  withPipe([](int fd) {
+    FILE *writer = fdopen(fd, "wb");
+    if (writer) {
+      benchSink("to pipe", writer);
+      fclose(writer);
+    } else {
+      close(fd);
+    }
+  });
+  // the ofstream opens the pipe again through /dev/fd
+  withPipe([](int fd) {
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+    benchStreamSink("to pipe", path);
+    close(fd);
+  });
+#endif
+}
+
+int main(int argc, char *argv[]){
+
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--min-time=", 11) == 0) min_time = atof(argv[i] + 11) / 1000.0;
+    else filter = argv[i];
+  }
+
+  StringAllocatorScope scope(allocations);
+
+  Out.print("{\"benchmarks\": [");
+  benchFormatting();
+  benchStrings(16);
+  benchStrings(256);
+  benchStrings(4096);
+  benchSinks();
+  Out.println("\n]}");
+
+  return 0;
+}
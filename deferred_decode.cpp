@@ -0,0 +1,59 @@
+/*
+  deferred_decode.cpp
+
+  Prints the binary records written by DeferredBinary (see
+  tools/DeferredLog.h) as the text print() and println() would have
+  produced at the time they were recorded.
+
+  Usage: deferred_decode [FILE]
+  Reads "stdin" when FILE is missing, so it can follow a pipe.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+  License GNU Lesser General Public License v3.0.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "src/OutputPrint.h"
+#include "tools/DeferredLog.h"
+
+int main(int argc, char *argv[]){
+
+    FILE *input = stdin;
+    if (argc > 1 && strcmp(argv[1], "-") != 0) {
+        input = fopen(argv[1], "rb");
+        if (!input) {
+            fprintf(stderr, "deferred_decode: cannot open %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    OutputPrint Out;
+    DeferredDecoder decoder(Out);
+
+    /* Records may be split between reads: keep the undecoded tail */
+    std::vector<uint8_t> data;
+    uint8_t chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), input)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+        size_t used = decoder.decode(data.data(), data.size());
+        data.erase(data.begin(), data.begin() + (long)used);
+        if (!decoder.ok()) break;
+    }
+    Out.flush();
+
+    if (input != stdin) fclose(input);
+
+    if (!decoder.ok()) {
+        fprintf(stderr, "deferred_decode: corrupt input\n");
+        return 1;
+    }
+    if (!data.empty()) {
+        fprintf(stderr, "deferred_decode: truncated record at the end\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+  BufferedPrint class writes to a file descriptor with write(2) through
+  a large buffer of its own, which is written out even if the process
+  crashes.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "BufferedPrint.h"
+
+// write(2) retrying on signals, returns < 0 on error.  Async-signal-safe.
+static long writeOutput(int fd, const char *buf, size_t n){
+  long r;
+#ifdef _WIN32
+  if (n > INT_MAX) n = INT_MAX;
+  do r = (long)_write(fd, buf, (unsigned int)n); while (r < 0 && errno == EINTR);
+#else
+  do r = (long)::write(fd, buf, n); while (r < 0 && errno == EINTR);
+#endif
+  return r;
+}
+
+BufferedPrint::BufferedPrint(int fd, size_t bufferSize, bool _crashSafe)
+  : output(fd), size(bufferSize ? bufferSize : 1), start(0), end(0), crashSafe(_crashSafe),
+    stats(PRINT_METRICS_NEW()){
+  buffer = (char*)malloc(size);
+  if (!buffer) size = 0;
+  if (crashSafe && buffer) crashSafe = CrashFlush::add(*this);
+}
+
+BufferedPrint::~BufferedPrint(){
+  if (crashSafe) CrashFlush::remove(*this);
+  flush();
+  free(buffer);
+  delete stats;
+}
+
+// writes all of data, false on error
+bool BufferedPrint::writeOut(const char *data, size_t length){
+  while (length > 0){
+    long n = writeOutput(output, data, length);
+    PRINT_METRICS_SYSCALL();
+    if (n <= 0) return false;
+    data += n;
+    length -= (size_t)n;
+  }
+  return true;
+}
+
+int BufferedPrint::flush(){
+  PRINT_METRICS_START();
+  size_t s = start.load(std::memory_order_relaxed);
+  size_t e = end.load(std::memory_order_relaxed);
+  // the bytes are taken before they go out: a crash in the middle of
+  // the write() loses the part not written yet, but nothing is written
+  // twice.  On error the unwritten part is pending again.
+  if (s < e) start.store(e, std::memory_order_release);
+  while (s < e){
+    long n = writeOutput(output, buffer + s, e - s);
+    PRINT_METRICS_SYSCALL();
+    if (n <= 0){
+      start.store(s, std::memory_order_release);
+      setWriteError();
+      PRINT_METRICS_FLUSH(false);
+      return -1;
+    }
+    s += (size_t)n;
+  }
+  // empty: back to the start of the buffer, end first so the handler
+  // never sees start > end
+  end.store(0, std::memory_order_release);
+  start.store(0, std::memory_order_release);
+  PRINT_METRICS_FLUSH(true);
+  return 0;
+}
+
+size_t BufferedPrint::write(uint8_t byte){
+  return write(&byte, 1);
+}
+
+size_t BufferedPrint::write(const uint8_t *data, size_t length){
+  PRINT_METRICS_START();
+  size_t e = end.load(std::memory_order_relaxed);
+  if (length > size - e){
+    if (flush() != 0){
+      PRINT_METRICS_WRITE(0, false);
+      return 0;
+    }
+    e = 0;
+    // too big for the buffer: straight out
+    if (length > size){
+      if (!writeOut((const char*)data, length)){
+        setWriteError();
+        PRINT_METRICS_WRITE(0, false);
+        return 0;
+      }
+      PRINT_METRICS_WRITE(length, true);
+      return length;
+    }
+  }
+  memcpy(buffer + e, data, length);
+  end.store(e + length, std::memory_order_release);
+  PRINT_METRICS_WRITE(length, true);
+  return length;
+}
+
+uint8_t *BufferedPrint::reserveWrite(size_t length){
+  if (length > size) return NULL;
+  if (length > size - end.load(std::memory_order_relaxed) && flush() != 0) return NULL;
+  return (uint8_t*)buffer + end.load(std::memory_order_relaxed);
+}
+
+size_t BufferedPrint::commitWrite(size_t length){
+  end.store(end.load(std::memory_order_relaxed) + length, std::memory_order_release);
+  return length;
+}
+
+void BufferedPrint::emergencyFlush(){
+  size_t s = start.load(std::memory_order_acquire);
+  size_t e = end.load(std::memory_order_acquire);
+  if (s < e){
+    // taken first, like flush(), so a second signal doesn't repeat them
+    start.store(e, std::memory_order_release);
+    writeOut(buffer + s, e - s);
+  }
+}
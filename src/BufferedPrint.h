@@ -0,0 +1,87 @@
+/*
+  BufferedPrint class writes to a file descriptor with write(2) through
+  a large buffer of its own, which is written out even if the process
+  crashes (see CrashFlush.h).
+
+  Use it instead of OutputPrint for high volume output: the stdio buffer
+  of OutputPrint is small and is lost on a crash.
+
+  Bytes are never written twice.  A crash while flush() is writing loses
+  the part of the buffer that write(2) had not taken yet; the rest of
+  the buffer is written by the crash handler.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _BUFFEREDPRINT_H_
+#define _BUFFEREDPRINT_H_
+
+#include <atomic>
+
+#include "../tools/Print.h"
+#include "CrashFlush.h"
+
+#ifndef BUFFEREDPRINT_SIZE
+#define BUFFEREDPRINT_SIZE (1024 * 1024)
+#endif
+
+// Not thread safe: use one BufferedPrint per thread, or a lock
+class BufferedPrint : public Print, public CrashFlushable
+{
+    private:
+      int output;                  // file descriptor
+      char *buffer;
+      size_t size;
+      // pending bytes are [start, end), atomics so the crash handler
+      // sees the bytes copied before them
+      std::atomic<size_t> start;
+      std::atomic<size_t> end;
+      bool crashSafe;
+      // NULL unless the library is built with OUTPUTPRINT_METRICS
+      PrintMetrics *stats;
+
+      bool writeOut(const char *data, size_t length);
+
+      // no copies, the buffer is owned
+      BufferedPrint(const BufferedPrint&);
+      BufferedPrint& operator=(const BufferedPrint&);
+
+    public:
+      // crashSafe registers the buffer with CrashFlush
+      explicit BufferedPrint(int fd = 1, size_t bufferSize = BUFFEREDPRINT_SIZE, bool crashSafe = true);
+      ~BufferedPrint();
+
+      // Write any unwritten buffered data
+      int flush();
+      // bytes waiting in the buffer
+      size_t pending() const { return end.load(std::memory_order_relaxed) - start.load(std::memory_order_relaxed); }
+
+      // Write methods
+      using Print::write;
+      size_t write(uint8_t);
+      size_t write(const uint8_t *buffer, size_t size);
+      uint8_t *reserveWrite(size_t size);
+      size_t commitWrite(size_t size);
+
+      void emergencyFlush();
+
+      // write() and flush() metrics, with the write(2) calls as syscalls
+      PrintMetricsSnapshot metrics() const { return stats ? stats->snapshot() : PrintMetricsSnapshot(); }
+      void resetMetrics() { if (stats) stats->reset(); }
+};
+
+#endif  //_BUFFEREDPRINT_H_
@@ -0,0 +1,153 @@
+/*
+  CrashFlush writes out the pending bytes of buffered sinks when the
+  process crashes or is terminated.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <signal.h>
+#include <stdlib.h>
+#include <atomic>
+#include <exception>
+#include <thread>
+
+#include "CrashFlush.h"
+
+// NULL slots are free; std::atomic of a pointer is lock free on every
+// supported target, so the handlers can read it
+static std::atomic<CrashFlushable*> slots[CRASHFLUSH_SLOTS];
+static std::atomic<bool> installed(false);
+static std::atomic<bool> flushing(false);
+// handlers walking the table, which remove() waits out
+static std::atomic<int> walking(0);
+
+bool CrashFlush::add(CrashFlushable &sink){
+  installHandlers();
+  for (int i = 0; i < CRASHFLUSH_SLOTS; i++){
+    CrashFlushable *empty = NULL;
+    if (slots[i].compare_exchange_strong(empty, &sink, std::memory_order_acq_rel)) return true;
+  }
+  return false;
+}
+
+void CrashFlush::remove(CrashFlushable &sink){
+  for (int i = 0; i < CRASHFLUSH_SLOTS; i++){
+    CrashFlushable *expected = &sink;
+    if (slots[i].compare_exchange_strong(expected, NULL)) break;
+  }
+  // a handler that read the slot before it was cleared may still be in
+  // emergencyFlush(): once no handler walks the table, none of them can
+  // hold the sink.  Sequentially consistent with the increment in
+  // flushAll(), so a handler counted after this load sees the NULL slot.
+  while (walking.load() > 0) std::this_thread::yield();
+}
+
+void CrashFlush::flushAll(){
+  // a crash inside an emergencyFlush() doesn't start over.  The sinks
+  // stay registered: a signal the program handles and survives must not
+  // turn crash flushing off, and flushing again (the terminate handler
+  // followed by SIGABRT) only writes what is still pending.
+  if (flushing.exchange(true, std::memory_order_acq_rel)) return;
+  walking.fetch_add(1);
+  for (int i = 0; i < CRASHFLUSH_SLOTS; i++){
+    CrashFlushable *sink = slots[i].load();
+    if (sink) sink->emergencyFlush();
+  }
+  walking.fetch_sub(1);
+  flushing.store(false, std::memory_order_release);
+}
+
+// Handlers ////////////////////////////////////////////////////////////////////
+
+static const int crash_signals[] = {SIGSEGV, SIGABRT, SIGTERM, SIGFPE, SIGILL,
+#ifdef SIGBUS
+  SIGBUS,
+#endif
+};
+static const int crash_signal_count = (int)(sizeof(crash_signals) / sizeof(crash_signals[0]));
+
+static std::terminate_handler previous_terminate = NULL;
+
+static void terminateHandler(){
+  CrashFlush::flushAll();
+  if (previous_terminate) previous_terminate();
+  abort();
+}
+
+#ifdef _WIN32
+
+static void (*previous_signals[crash_signal_count])(int);
+
+static void signalHandler(int sig){
+  CrashFlush::flushAll();
+  for (int i = 0; i < crash_signal_count; i++){
+    if (crash_signals[i] == sig){
+      signal(sig, previous_signals[i] == SIG_ERR ? SIG_DFL : previous_signals[i]);
+      break;
+    }
+  }
+  raise(sig);
+  // still running: the previous handler took the signal, back in place
+  // for the next one
+  signal(sig, signalHandler);
+}
+
+static void installSignals(){
+  for (int i = 0; i < crash_signal_count; i++){
+    previous_signals[i] = signal(crash_signals[i], signalHandler);
+  }
+}
+
+#else
+
+static struct sigaction previous_signals[crash_signal_count];
+static struct sigaction crash_action;
+
+static void signalHandler(int sig){
+  CrashFlush::flushAll();
+  // back to the previous action and deliver the signal again: the
+  // default action, or the handler the program had installed
+  for (int i = 0; i < crash_signal_count; i++){
+    if (crash_signals[i] == sig){
+      sigaction(sig, &previous_signals[i], NULL);
+      break;
+    }
+  }
+  raise(sig);
+  // still running: the signal was ignored or handled by the program,
+  // which goes on, so the crash handler goes back in place
+  sigaction(sig, &crash_action, NULL);
+}
+
+static void installSignals(){
+  crash_action.sa_handler = signalHandler;
+  sigemptyset(&crash_action.sa_mask);
+  // SA_NODEFER so raise() from the handler is delivered at once
+  crash_action.sa_flags = SA_NODEFER;
+  for (int i = 0; i < crash_signal_count; i++){
+    sigaction(crash_signals[i], &crash_action, &previous_signals[i]);
+  }
+}
+
+#endif
+
+void CrashFlush::installHandlers(){
+  bool expected = false;
+  if (!installed.compare_exchange_strong(expected, true)) return;
+  installSignals();
+  previous_terminate = std::set_terminate(terminateHandler);
+}
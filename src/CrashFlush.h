@@ -0,0 +1,70 @@
+/*
+  CrashFlush writes out the pending bytes of buffered sinks when the
+  process crashes or is terminated (SIGSEGV, SIGBUS, SIGFPE, SIGILL,
+  SIGABRT, SIGTERM and std::terminate), so large output buffers don't
+  lose the last lines before a crash.
+
+  Sinks register in a fixed, lock-free table; the handlers only read
+  that table and call write(2), which is async-signal-safe.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _CRASHFLUSH_H_
+#define _CRASHFLUSH_H_
+
+#include <stddef.h>
+
+// Sinks registered at the same time
+#ifndef CRASHFLUSH_SLOTS
+#define CRASHFLUSH_SLOTS 64
+#endif
+
+// A sink with a buffer to write out on a crash
+class CrashFlushable
+{
+    public:
+      virtual ~CrashFlushable() {}
+      // called from a signal handler: only async-signal-safe calls,
+      // no locks, no allocation.  It may be called again later (the
+      // program may survive a handled signal), so it takes the pending
+      // bytes before writing them and never writes anything twice.
+      virtual void emergencyFlush() = 0;
+};
+
+class CrashFlush
+{
+    public:
+      // false if the table is full
+      static bool add(CrashFlushable &sink);
+      // returns once no handler is flushing: the sink can then be
+      // destroyed.  Not to be called from emergencyFlush().
+      static void remove(CrashFlushable &sink);
+
+      // calls emergencyFlush() on every registered sink, async-signal-safe
+      static void flushAll();
+
+      // installs the signal and terminate handlers, once.  The previous
+      // handlers are kept and run after the flush, so default actions
+      // (core dump, exit status) are unchanged.  When a previous handler
+      // returns (SIGTERM handled by the program, for example), the sinks
+      // are still registered and the crash handler is reinstalled.
+      // Called by add().
+      static void installHandlers();
+};
+
+#endif  //_CRASHFLUSH_H_
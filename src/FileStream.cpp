@@ -0,0 +1,227 @@
+/*
+  FileStream class adds Arduino Stream input (read(), peek(),
+  available(), readStringUntil(), parseInt(), ...) to OutputPrint.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "FileStream.h"
+
+// read(2) retrying on signals, returns <= 0 at end of file or error
+static long readInput(int fd, char *buf, size_t n){
+  long r;
+#ifdef _WIN32
+  if (n > INT_MAX) n = INT_MAX;
+  do r = (long)_read(fd, buf, (unsigned int)n); while (r < 0 && errno == EINTR);
+#else
+  do r = (long)::read(fd, buf, n); while (r < 0 && errno == EINTR);
+#endif
+  return r;
+}
+
+// true if a read would not block
+static bool inputReady(int fd){
+#ifdef _WIN32
+  (void)fd;
+  return false;
+#else
+  struct pollfd p;
+  p.fd = fd;
+  p.events = POLLIN;
+  p.revents = 0;
+  return poll(&p, 1, 0) > 0;
+#endif
+}
+
+FileStream::FileStream(FILE* _input, FILE* _output, size_t bufferSize) : OutputPrint(_output){
+#ifdef _WIN32
+  input = _input ? _fileno(_input) : -1;
+#else
+  input = _input ? fileno(_input) : -1;
+#endif
+  buffer = NULL;
+  size = bufferSize ? bufferSize : 1;
+  start = end = 0;
+  eof = input < 0;
+}
+
+FileStream::FileStream(int _input, FILE* _output, size_t bufferSize) : OutputPrint(_output){
+  input = _input;
+  buffer = NULL;
+  size = bufferSize ? bufferSize : 1;
+  start = end = 0;
+  eof = input < 0;
+}
+
+FileStream::~FileStream(){
+  free(buffer);
+}
+
+size_t FileStream::fill(){
+  if (eof) return 0;
+  if (start == end) start = end = 0;
+  if (buffer == NULL){
+    buffer = (char *)malloc(size);
+    if (buffer == NULL) return 0;
+  }
+  if (end == size){
+    if (start > 0){
+      // move the unread tail to the front
+      memmove(buffer, buffer + start, end - start);
+      end -= start;
+      start = 0;
+    } else {
+      // a single line fills the buffer
+      char *grown = (char *)realloc(buffer, size * 2);
+      if (grown == NULL) return 0;
+      buffer = grown;
+      size *= 2;
+    }
+  }
+  // a prompt must be visible before waiting for the answer, but there is
+  // no need to flush when the input is already there
+  if (!inputReady(input)) OutputPrint::flush();
+  long n = readInput(input, buffer + end, size - end);
+  if (n <= 0){
+    eof = true;
+    return 0;
+  }
+  end += (size_t)n;
+  return (size_t)n;
+}
+
+int FileStream::timedRead(){
+  return read();
+}
+
+int FileStream::timedPeek(){
+  return peek();
+}
+
+int FileStream::available(){
+  if (start == end && !eof && inputReady(input)) fill();
+  size_t n = end - start;
+  return n > INT_MAX ? INT_MAX : (int)n;
+}
+
+int FileStream::read(){
+  if (start == end && fill() == 0) return -1;
+  return (unsigned char)buffer[start++];
+}
+
+int FileStream::peek(){
+  if (start == end && fill() == 0) return -1;
+  return (unsigned char)buffer[start];
+}
+
+bool FileStream::atEnd(){
+  return start == end && fill() == 0;
+}
+
+size_t FileStream::readBytes(char *dest, size_t length){
+  size_t count = 0;
+  while (count < length){
+    if (start == end && fill() == 0) break;
+    size_t n = end - start;
+    if (n > length - count) n = length - count;
+    memcpy(dest + count, buffer + start, n);
+    start += n;
+    count += n;
+  }
+  return count;
+}
+
+size_t FileStream::readBytesUntil(char terminator, char *dest, size_t length){
+  size_t count = 0;
+  while (count < length){
+    if (start == end && fill() == 0) break;
+    size_t n = end - start;
+    if (n > length - count) n = length - count;
+    const char *found = (const char *)memchr(buffer + start, terminator, n);
+    if (found){
+      n = (size_t)(found - (buffer + start));
+      memcpy(dest + count, buffer + start, n);
+      start += n + 1;  // the terminator is consumed
+      return count + n;
+    }
+    memcpy(dest + count, buffer + start, n);
+    start += n;
+    count += n;
+  }
+  return count;
+}
+
+String FileStream::readString(){
+  String ret;
+  while (start < end || fill() > 0){
+    ret.concat(StringView(buffer + start, end - start));
+    start = end;
+  }
+  return ret;
+}
+
+String FileStream::readStringUntil(char terminator){
+  StringView field;
+  if (!readUntil(terminator, field)) return String();
+  return String(field);
+}
+
+bool FileStream::readUntil(char terminator, StringView &field){
+  size_t scanned = 0;  // bytes after start known not to hold the terminator
+  for (;;){
+    const char *found = NULL;
+    if (end - start > scanned) found = (const char *)memchr(buffer + start + scanned, terminator, end - start - scanned);
+    if (found){
+      size_t n = (size_t)(found - (buffer + start));
+      field = StringView(buffer + start, n);
+      start += n + 1;
+      return true;
+    }
+    scanned = end - start;
+    if (fill() == 0){
+      if (start == end) return false;
+      // last field, not terminated
+      field = StringView(buffer + start, end - start);
+      start = end;
+      return true;
+    }
+  }
+}
+
+bool FileStream::readLine(StringView &line){
+  if (!readUntil('\n', line)) return false;
+  if (line.length() > 0 && line[line.length() - 1] == '\r'){
+    line = line.subview(0, line.length() - 1);
+  }
+  return true;
+}
+
+#ifdef stdout
+FileStream Serial(stdin, stdout);
+#endif
@@ -0,0 +1,102 @@
+/*
+  FileStream class adds Arduino Stream input (read(), peek(),
+  available(), readStringUntil(), parseInt(), ...) to OutputPrint.
+
+  Input is read from a FILE (or a file descriptor) through a large
+  refillable buffer, and readLine() / readUntil() return views into that
+  buffer, so lines and fields are scanned with memchr() and never copied.
+  A FileStream is an OutputPrint, output goes to its FILE.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _FILESTREAM_H_
+#define _FILESTREAM_H_
+
+#include "../tools/Stream.h"
+#include "OutputPrint.h"
+
+// Initial input buffer size, the buffer grows when a line doesn't fit
+#ifndef FILESTREAM_BUFFER_SIZE
+#define FILESTREAM_BUFFER_SIZE 65536
+#endif
+
+class FileStream : public Stream, public OutputPrint
+{
+    private:
+      int input;          // input file descriptor, -1 if none
+      char *buffer;       // allocated on the first read
+      size_t size;        // buffer size
+      size_t start;       // unread bytes are [start, end)
+      size_t end;
+      bool eof;
+
+      size_t fill();      // read more input, returns the number of new bytes
+
+      // no copies, the buffer is owned
+      FileStream(const FileStream&);
+      FileStream& operator=(const FileStream&);
+
+    protected:
+      // reads block until there is input, end of file means no more data
+      int timedRead();
+      int timedPeek();
+
+    public:
+      // Constructors.  The input is read from fileno(input) with read(2)
+      // into the buffer of the FileStream, not through stdio: don't read
+      // the same FILE with fgets(), getc(), ... as well, and read nothing
+      // from it before, since what stdio has buffered is not seen.
+#ifdef stdout
+      FileStream(FILE* input = stdin, FILE* output = stdout, size_t bufferSize = FILESTREAM_BUFFER_SIZE);
+#else
+      FileStream(FILE* input, FILE* output, size_t bufferSize = FILESTREAM_BUFFER_SIZE);
+#endif
+      // Read from a file descriptor, as returned by open() or fileno()
+      FileStream(int input, FILE* output, size_t bufferSize = FILESTREAM_BUFFER_SIZE);
+      ~FileStream();
+
+      // Stream methods
+      int available();
+      int read();
+      int peek();
+      size_t readBytes(char *buffer, size_t length);
+      size_t readBytesUntil(char terminator, char *buffer, size_t length);
+      String readString();
+      String readStringUntil(char terminator);
+      using Stream::readBytes;
+      using Stream::readBytesUntil;
+
+      // Zero-copy readers: the view points into the input buffer and is
+      // only valid until the next read from this stream.
+      // Next line without its "\n" or "\r\n", false at end of input
+      bool readLine(StringView &line);
+      // Next field up to the terminator (not included), the last field
+      // ends at end of input, false when there is nothing left
+      bool readUntil(char terminator, StringView &field);
+
+      // true when all input has been read
+      bool atEnd();
+
+      // write(), flush() and metrics() are those of OutputPrint
+};
+
+#ifdef stdout
+extern FileStream Serial;
+#endif
+
+#endif  //_FILESTREAM_H_
@@ -27,16 +27,37 @@
 
 OutputPrint::OutputPrint(FILE* _output){
   output = _output;
+  stats = PRINT_METRICS_NEW();
+}
+
+OutputPrint::~OutputPrint(){
+  delete stats;
 }
 
 int OutputPrint::flush(){
-  return fflush(output);
+  PRINT_METRICS_START();
+  int result = fflush(output);
+  PRINT_METRICS_SYSCALL();
+  PRINT_METRICS_FLUSH(result == 0);
+  return result;
 }
 
 size_t OutputPrint::write(uint8_t byte){
-  return (size_t)putc(byte, output);
+  PRINT_METRICS_START();
+  if (putc(byte, output) == EOF){
+    setWriteError();
+    PRINT_METRICS_WRITE(0, false);
+    return 0;
+  }
+  PRINT_METRICS_WRITE(1, true);
+  return 1;
 }
 
-#ifdef stdout
-OutputPrint Serial(stdout);
-#endif
\ No newline at end of file
+size_t OutputPrint::write(const uint8_t *buffer, size_t size){
+  PRINT_METRICS_START();
+  size_t n = fwrite(buffer, 1, size, output);
+  PRINT_METRICS_SYSCALL();
+  if (n < size) setWriteError();
+  PRINT_METRICS_WRITE(n, n == size);
+  return n;
+}
\ No newline at end of file
@@ -5,6 +5,7 @@
   OutputPrint class can use any file descriptor as output, 
   by default "stdout" if defined, and add a dummy "Serial" 
   instance to emulate Arduino Serial.print() function.
+  Serial is a FileStream, an OutputPrint that also reads from "stdin".
 
   Copyright (c) 2021 Jorge Rivera. All right reserved.
 
@@ -28,10 +29,17 @@
 
 #include "../tools/Print.h"
 
-class OutputPrint : public Print
+// Print is a virtual base, shared with Stream in FileStream
+class OutputPrint : public virtual Print
 { 
     private:
       FILE* output;
+      // NULL unless the library is built with OUTPUTPRINT_METRICS
+      PrintMetrics *stats;
+
+      // no copies, the metrics are owned
+      OutputPrint(const OutputPrint&);
+      OutputPrint& operator=(const OutputPrint&);
 
     public:
       // Constructor
@@ -40,18 +48,24 @@ class OutputPrint : public Print
 #else
       OutputPrint(FILE*);
 #endif    
+      ~OutputPrint();
 
       // Write any unwritten buffered data
       int flush();
       
-      // Write method
+      // Write methods
       using Print::write;
       size_t write(uint8_t);
+      size_t write(const uint8_t *buffer, size_t size);
+
+      // write() and flush() metrics, with the fwrite() and fflush()
+      // calls as syscalls
+      PrintMetricsSnapshot metrics() const { return stats ? stats->snapshot() : PrintMetricsSnapshot(); }
+      void resetMetrics() { if (stats) stats->reset(); }
 
 };
 
-#ifdef stdout
-extern OutputPrint Serial;
-#endif
+// Serial is a FileStream, reading stdin and writing stdout
+#include "FileStream.h"
 
 #endif  //_OUTPUTPRINT_H_
@@ -0,0 +1,525 @@
+/*
+  ShmRing is a lock-free multi-producer ring of lines in POSIX shared
+  memory, with a Print sink for the producers and a collector draining
+  it to another Print.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ShmRing.h"
+
+#define SHMRING_MAGIC 0x53524E47u  // "SRNG"
+#define SHMRING_VERSION 3
+
+// sequence of a retired slot, skipped by producers and the collector
+#define SHMRING_RETIRED UINT64_MAX
+
+// The ring is a bounded queue of fixed size slots.  Each slot carries a
+// sequence number: position when it is free for the producer of that
+// position, position + 1 once that record is committed, and position +
+// slots after the collector took it, which makes it free for the next
+// lap.  Producers claim a position with a CAS on head; the only collector
+// advances tail.  A slot whose producer stalls without being known dead is
+// retired for good (SHMRING_RETIRED), since the producer may still write
+// to it.  The atomics are lock free, so they work between processes.
+struct ShmRingHeader
+{
+  std::atomic<uint32_t> magic; // stored last by create()
+  uint32_t version;
+  uint64_t slots;              // power of two
+  uint64_t slotSize;           // payload bytes
+  uint64_t stride;             // bytes between slots
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+  alignas(64) std::atomic<uint64_t> published;
+  std::atomic<uint64_t> dropped;
+  std::atomic<uint64_t> abandoned;
+  std::atomic<uint64_t> retired;
+  std::atomic<uint64_t> skipped;   // retired slots stepped over, no loss
+  std::atomic<uint64_t> unplaced;  // records lost, every slot retired
+};
+
+struct ShmRingSlot
+{
+  std::atomic<uint64_t> sequence;
+  std::atomic<int32_t> pid;    // producer, 0 until it is known
+  uint32_t length;
+};
+
+static const size_t header_size = (sizeof(ShmRingHeader) + 63) & ~(size_t)63;
+
+static char *slotData(ShmRingSlot *slot){
+  return (char*)slot + sizeof(ShmRingSlot);
+}
+
+// getpid() is a system call on current libcs; the value is cached and
+// forgotten in forked children
+static std::atomic<int32_t> cached_pid(0);
+
+#ifndef _WIN32
+
+static void forgetPid(){
+  cached_pid.store(0, std::memory_order_relaxed);
+}
+
+static void watchForks(){
+  static std::atomic<bool> registered(false);
+  bool expected = false;
+  if (registered.compare_exchange_strong(expected, true)) pthread_atfork(NULL, NULL, forgetPid);
+}
+
+// async-signal-safe
+static int32_t currentPid(){
+  int32_t pid = cached_pid.load(std::memory_order_relaxed);
+  if (pid == 0){
+    pid = (int32_t)getpid();
+    cached_pid.store(pid, std::memory_order_relaxed);
+  }
+  return pid;
+}
+
+// false only if the process is known to be gone
+static bool processAlive(int32_t pid){
+  return kill((pid_t)pid, 0) == 0 || errno != ESRCH;
+}
+
+#else
+
+static void watchForks(){
+}
+
+static int32_t currentPid(){
+  return 0;
+}
+
+// currentPid() is 0 here, so slots never name a producer to check
+static bool processAlive(int32_t pid){
+  (void)pid;
+  return true;
+}
+
+#endif
+
+// ShmRing /////////////////////////////////////////////////////////////////////
+
+ShmRing::ShmRing() : header(NULL), mapped(0){
+}
+
+ShmRing::~ShmRing(){
+  close();
+}
+
+bool ShmRing::create(const char *name, size_t slots, size_t slotSize){
+  close();
+#ifdef _WIN32
+  return false;
+#else
+  if (!std::atomic<uint64_t>().is_lock_free()) return false;
+  if (slots < 2 || slotSize == 0 || slotSize > 0xFFFFFFFFu) return false;
+  size_t count = 2;
+  while (count < slots) count <<= 1;
+  size_t stride = (sizeof(ShmRingSlot) + slotSize + 63) & ~(size_t)63;
+  size_t total = header_size + count * stride;
+
+  void *memory;
+  if (name){
+    // never over a ring that exists, it may be in use
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return false;
+    if (ftruncate(fd, (off_t)total) != 0){
+      ::close(fd);
+      shm_unlink(name);
+      return false;
+    }
+    memory = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+  } else {
+    memory = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  }
+  if (memory == MAP_FAILED) return false;
+
+  ShmRingHeader *h = new (memory) ShmRingHeader();
+  h->version = SHMRING_VERSION;
+  h->slots = count;
+  h->slotSize = slotSize;
+  h->stride = stride;
+  h->head.store(0, std::memory_order_relaxed);
+  h->tail.store(0, std::memory_order_relaxed);
+  h->published.store(0, std::memory_order_relaxed);
+  h->dropped.store(0, std::memory_order_relaxed);
+  h->abandoned.store(0, std::memory_order_relaxed);
+  h->retired.store(0, std::memory_order_relaxed);
+  h->skipped.store(0, std::memory_order_relaxed);
+  h->unplaced.store(0, std::memory_order_relaxed);
+  for (size_t i = 0; i < count; i++){
+    ShmRingSlot *s = new ((char*)memory + header_size + i * stride) ShmRingSlot();
+    s->sequence.store(i, std::memory_order_relaxed);
+    s->pid.store(0, std::memory_order_relaxed);
+    s->length = 0;
+  }
+  // the magic last: attach() of a half built ring fails
+  h->magic.store(SHMRING_MAGIC, std::memory_order_release);
+
+  header = h;
+  mapped = total;
+  watchForks();
+  return true;
+#endif
+}
+
+bool ShmRing::attach(const char *name){
+  close();
+#ifdef _WIN32
+  return false;
+#else
+  if (!name) return false;
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < header_size){
+    ::close(fd);
+    return false;
+  }
+  size_t total = (size_t)st.st_size;
+  void *memory = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (memory == MAP_FAILED) return false;
+
+  ShmRingHeader *h = (ShmRingHeader*)memory;
+  // the geometry is only read once the magic says it is complete
+  if (h->magic.load(std::memory_order_acquire) != SHMRING_MAGIC){
+    munmap(memory, total);
+    return false;
+  }
+  if (h->version != SHMRING_VERSION || h->slots == 0
+      || (h->slots & (h->slots - 1)) != 0 || h->stride < sizeof(ShmRingSlot) + h->slotSize
+      || total < header_size + h->slots * h->stride){
+    munmap(memory, total);
+    return false;
+  }
+  header = h;
+  mapped = total;
+  watchForks();
+  return true;
+#endif
+}
+
+void ShmRing::close(){
+#ifndef _WIN32
+  if (header) munmap(header, mapped);
+#endif
+  header = NULL;
+  mapped = 0;
+}
+
+bool ShmRing::unlink(const char *name){
+#ifdef _WIN32
+  return false;
+#else
+  return shm_unlink(name) == 0;
+#endif
+}
+
+size_t ShmRing::slotSize() const{
+  return header ? (size_t)header->slotSize : 0;
+}
+
+ShmRingSlot *ShmRing::slot(uint64_t position) const{
+  return (ShmRingSlot*)((char*)header + header_size + (size_t)(position & (header->slots - 1)) * header->stride);
+}
+
+// lock free and async-signal-safe
+bool ShmRing::publish(const char *data, size_t size){
+  if (!header) return false;
+  if (size > header->slotSize) size = (size_t)header->slotSize;
+
+  uint64_t position = header->head.load(std::memory_order_relaxed);
+  ShmRingSlot *s;
+  uint64_t skipped = 0;
+  for (;;){
+    s = slot(position);
+    uint64_t sequence = s->sequence.load(std::memory_order_acquire);
+    int64_t lap = (int64_t)(sequence - position);
+    if (sequence == SHMRING_RETIRED){
+      // step over it, unless every slot is retired.  Not a drop: the
+      // ring isn't full, and the record goes to the next slot.
+      if (++skipped > header->slots){
+        header->unplaced.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      if (header->head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)){
+        header->skipped.fetch_add(1, std::memory_order_relaxed);
+      }
+      position = header->head.load(std::memory_order_relaxed);
+    } else if (lap == 0){
+      if (header->head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+    } else if (lap < 0){
+      // the slot still holds the record of the previous lap: full
+      header->dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      position = header->head.load(std::memory_order_relaxed);
+    }
+  }
+
+  s->pid.store(currentPid(), std::memory_order_relaxed);
+  s->length = (uint32_t)size;
+  memcpy(slotData(s), data, size);
+  // fails if the collector gave the slot up, see ShmRingCollector::skipStalled()
+  uint64_t expected = position;
+  if (!s->sequence.compare_exchange_strong(expected, position + 1, std::memory_order_release, std::memory_order_relaxed)){
+    return false;
+  }
+  header->published.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+uint64_t ShmRing::published() const{
+  return header ? header->published.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t ShmRing::dropped() const{
+  return header ? header->dropped.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t ShmRing::abandoned() const{
+  return header ? header->abandoned.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t ShmRing::retired() const{
+  return header ? header->retired.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t ShmRing::skipped() const{
+  return header ? header->skipped.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t ShmRing::unplaced() const{
+  return header ? header->unplaced.load(std::memory_order_relaxed) : 0;
+}
+
+// ShmRingPrint ////////////////////////////////////////////////////////////////
+
+ShmRingPrint::ShmRingPrint(ShmRing &_ring, bool _crashSafe)
+  : ring(_ring), len(0), size(_ring.slotSize()), drops(0), crashSafe(_crashSafe){
+  line = size ? (char*)malloc(size) : NULL;
+  if (!line) size = 0;
+  if (crashSafe && line) crashSafe = CrashFlush::add(*this);
+}
+
+ShmRingPrint::~ShmRingPrint(){
+  if (crashSafe) CrashFlush::remove(*this);
+  flush();
+  free(line);
+}
+
+void ShmRingPrint::publish(){
+  if (!ring.publish(line, len)){
+    drops++;
+    setWriteError();
+  }
+  len = 0;
+}
+
+int ShmRingPrint::flush(){
+  if (len) publish();
+  return getWriteError() ? -1 : 0;
+}
+
+size_t ShmRingPrint::write(uint8_t byte){
+  return write(&byte, 1);
+}
+
+size_t ShmRingPrint::write(const uint8_t *data, size_t length){
+  if (!line){
+    setWriteError();
+    return 0;
+  }
+  const char *p = (const char*)data;
+  size_t left = length;
+  while (left > 0){
+    size_t take = left < size - len ? left : size - len;
+    const char *eol = (const char*)memchr(p, '\n', take);
+    if (eol) take = (size_t)(eol - p) + 1;
+    memcpy(line + len, p, take);
+    len += take;
+    p += take;
+    left -= take;
+    if (eol || len == size) publish();
+  }
+  return length;
+}
+
+void ShmRingPrint::emergencyFlush(){
+  // taken first, see CrashFlushable
+  size_t n = len;
+  len = 0;
+  if (n) ring.publish(line, n);
+}
+
+// ShmRingCollector ////////////////////////////////////////////////////////////
+
+static double monotonicSeconds(){
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ShmRingCollector::ShmRingCollector(ShmRing &_ring, Print &_output, size_t batchSize)
+  : ring(_ring), output(_output), len(0), report(true), stalledAt(0), stalledSince(0){
+  // room for a whole slot and a loss report line
+  size = batchSize;
+  if (size < ring.slotSize() + 128) size = ring.slotSize() + 128;
+  batch = (char*)malloc(size);
+  if (!batch) size = 0;
+  reportedDrops = ring.dropped();
+  reportedAbandoned = ring.abandoned();
+  reportedRetired = ring.retired();
+  reportedUnplaced = ring.unplaced();
+}
+
+ShmRingCollector::~ShmRingCollector(){
+  writeBatch();
+  free(batch);
+}
+
+void ShmRingCollector::writeBatch(){
+  if (len) output.write((const uint8_t*)batch, len);
+  len = 0;
+}
+
+void ShmRingCollector::append(const char *data, size_t length){
+  if (length > size - len) writeBatch();
+  if (length > size){
+    output.write((const uint8_t*)data, length);
+    return;
+  }
+  memcpy(batch + len, data, length);
+  len += length;
+}
+
+void ShmRingCollector::reportLosses(){
+  uint64_t drops = ring.dropped();
+  uint64_t abandoned = ring.abandoned();
+  uint64_t retired = ring.retired();
+  uint64_t unplaced = ring.unplaced();
+  if (report){
+    char text[128];
+    int n;
+    if (drops != reportedDrops){
+      n = snprintf(text, sizeof(text), "shmring: %llu records dropped, ring full\n",
+                   (unsigned long long)(drops - reportedDrops));
+      if (n > 0) append(text, (size_t)n);
+    }
+    if (abandoned != reportedAbandoned){
+      n = snprintf(text, sizeof(text), "shmring: %llu records abandoned by dead producers\n",
+                   (unsigned long long)(abandoned - reportedAbandoned));
+      if (n > 0) append(text, (size_t)n);
+    }
+    if (retired != reportedRetired){
+      n = snprintf(text, sizeof(text), "shmring: %llu slots retired, their producers stalled\n",
+                   (unsigned long long)(retired - reportedRetired));
+      if (n > 0) append(text, (size_t)n);
+    }
+    if (unplaced != reportedUnplaced){
+      n = snprintf(text, sizeof(text), "shmring: %llu records dropped, every slot retired\n",
+                   (unsigned long long)(unplaced - reportedUnplaced));
+      if (n > 0) append(text, (size_t)n);
+    }
+  }
+  reportedDrops = drops;
+  reportedAbandoned = abandoned;
+  reportedRetired = retired;
+  reportedUnplaced = unplaced;
+}
+
+// position was claimed but isn't committed: true if the slot was given up.
+// A slot whose producer is known to be gone (kill() fails with ESRCH) is
+// freed for the next lap at once.  Any other producer may still write to
+// the slot, so after SHMRING_STALL_TIMEOUT seconds the slot is retired
+// instead: skipped from then on and never reused.
+bool ShmRingCollector::skipStalled(uint64_t position, ShmRingSlot *slot){
+  ShmRingHeader *h = ring.shared();
+  int32_t pid = slot->pid.load(std::memory_order_relaxed);
+  if (pid != 0 && !processAlive(pid)){
+    uint64_t expected = position;
+    slot->pid.store(0, std::memory_order_relaxed);
+    // the producer may have committed in between
+    if (!slot->sequence.compare_exchange_strong(expected, position + h->slots, std::memory_order_acq_rel)) return false;
+    h->abandoned.fetch_add(1, std::memory_order_relaxed);
+    stalledAt = 0;
+    return true;
+  }
+
+  double now = monotonicSeconds();
+  if (stalledAt != position + 1){
+    stalledAt = position + 1;
+    stalledSince = now;
+  }
+  if (now - stalledSince < SHMRING_STALL_TIMEOUT) return false;
+  uint64_t expected = position;
+  // the late commit of the producer fails, and publish() returns false
+  if (!slot->sequence.compare_exchange_strong(expected, SHMRING_RETIRED, std::memory_order_acq_rel)) return false;
+  h->retired.fetch_add(1, std::memory_order_relaxed);
+  stalledAt = 0;
+  return true;
+}
+
+size_t ShmRingCollector::drain(){
+  if (!ring.valid() || !batch) return 0;
+  ShmRingHeader *h = ring.shared();
+  uint64_t tail = h->tail.load(std::memory_order_relaxed);
+  size_t records = 0;
+  // one lap at most, so busy producers don't keep the collector here
+  for (size_t i = 0; i < h->slots; i++){
+    ShmRingSlot *s = ring.slot(tail);
+    uint64_t sequence = s->sequence.load(std::memory_order_acquire);
+    if (sequence == tail + 1){
+      append(slotData(s), s->length);
+      // unknown pid for the next producer of the slot until it writes its own
+      s->pid.store(0, std::memory_order_relaxed);
+      s->sequence.store(tail + h->slots, std::memory_order_release);
+      records++;
+    } else if (sequence == SHMRING_RETIRED && h->head.load(std::memory_order_acquire) > tail){
+      // retired earlier, the producers step over it too
+    } else if (sequence == tail && h->head.load(std::memory_order_acquire) > tail){
+      if (!skipStalled(tail, s)) break;
+    } else {
+      break;
+    }
+    tail++;
+    h->tail.store(tail, std::memory_order_relaxed);
+  }
+  reportLosses();
+  writeBatch();
+  return records;
+}
@@ -0,0 +1,192 @@
+/*
+  ShmRing is a lock-free multi-producer ring of lines in POSIX shared
+  memory: processes (pre-forked workers, for example) print to it with
+  ShmRingPrint, one record per line, and a collector process drains it
+  to a real sink with ShmRingCollector, in batches.
+
+    ShmRing ring;
+    ring.create(NULL);               // anonymous, shared with forked children
+    if (fork() == 0) {
+      ShmRingPrint out(ring);
+      out.println("hello from a worker");
+      ...
+    }
+    ShmRingCollector collector(ring, Serial);
+    for (;;) if (collector.drain() == 0) usleep(1000);
+
+  A full ring drops the new lines, a producer that dies in the middle of
+  a line leaves a slot that the collector skips, and a slot whose producer
+  stalls for SHMRING_STALL_TIMEOUT seconds without being known dead is
+  retired for good; all are counted and, by default, reported by the
+  collector as lines of the output.
+
+  POSIX only, create() and attach() fail on other systems.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef _SHMRING_H_
+#define _SHMRING_H_
+
+#include <stdint.h>
+
+#include "../tools/Print.h"
+#include "CrashFlush.h"
+
+// Default ring geometry: 4096 lines of up to 496 bytes, about 2 MB
+#ifndef SHMRING_SLOTS
+#define SHMRING_SLOTS 4096
+#endif
+#ifndef SHMRING_SLOT_SIZE
+#define SHMRING_SLOT_SIZE 496
+#endif
+
+// Seconds before the collector retires the slot of a line that was
+// started by a process not known to be dead (see ShmRingCollector)
+#ifndef SHMRING_STALL_TIMEOUT
+#define SHMRING_STALL_TIMEOUT 5
+#endif
+
+struct ShmRingHeader;
+struct ShmRingSlot;
+
+class ShmRing
+{
+    private:
+      ShmRingHeader *header;
+      size_t mapped;          // bytes mapped
+
+      ShmRing(const ShmRing&);
+      ShmRing& operator=(const ShmRing&);
+
+    public:
+      ShmRing();
+      ~ShmRing();
+
+      // creates a ring of slots lines of slotSize bytes at most; name is
+      // a shm_open() name like "/myapp-log", NULL for an anonymous ring
+      // shared with the children forked afterwards.  False on failure,
+      // including when name exists (errno EEXIST): attach() to it, or
+      // unlink() it first if it is known to be stale.
+      bool create(const char *name, size_t slots = SHMRING_SLOTS, size_t slotSize = SHMRING_SLOT_SIZE);
+      // maps a ring created by another process
+      bool attach(const char *name);
+      // unmaps the ring, the shared memory object stays until unlink()
+      void close();
+      static bool unlink(const char *name);
+
+      bool valid() const { return header != NULL; }
+      size_t slotSize() const;
+
+      // adds one record (truncated to slotSize), false if the ring is full
+      bool publish(const char *data, size_t size);
+
+      // counters shared by all the processes
+      uint64_t published() const;
+      uint64_t dropped() const;    // records lost because the ring was full
+      uint64_t abandoned() const;  // records skipped, their producer died
+      uint64_t retired() const;    // slots given up for good, see drain()
+      uint64_t skipped() const;    // retired slots producers stepped over
+      uint64_t unplaced() const;   // records lost because every slot is retired
+
+      // internals for ShmRingCollector
+      ShmRingSlot *slot(uint64_t position) const;
+      ShmRingHeader *shared() const { return header; }
+};
+
+// Print sink writing to a ShmRing: bytes are kept until the end of the
+// line, then the whole line is published as one record, so lines of
+// different processes never mix.  Lines longer than the slot size are
+// split in several records.  Not thread safe, use one per thread.
+class ShmRingPrint : public Print, public CrashFlushable
+{
+    private:
+      ShmRing &ring;
+      char *line;
+      size_t len;
+      size_t size;
+      size_t drops;
+      bool crashSafe;
+
+      void publish();
+
+      ShmRingPrint(const ShmRingPrint&);
+      ShmRingPrint& operator=(const ShmRingPrint&);
+
+    public:
+      // crashSafe registers the sink with CrashFlush
+      explicit ShmRingPrint(ShmRing &ring, bool crashSafe = true);
+      ~ShmRingPrint();
+
+      // publishes the incomplete line, if any
+      int flush();
+
+      // records this sink could not publish because the ring was full
+      size_t dropped() const { return drops; }
+
+      using Print::write;
+      size_t write(uint8_t);
+      size_t write(const uint8_t *buffer, size_t size);
+
+      // publishes the incomplete line on a crash
+      void emergencyFlush();
+};
+
+// Moves the records of a ShmRing to a Print, several records per write().
+// Only one collector per ring.
+class ShmRingCollector
+{
+    private:
+      ShmRing &ring;
+      Print &output;
+      char *batch;
+      size_t len;
+      size_t size;
+      bool report;
+      uint64_t reportedDrops;
+      uint64_t reportedAbandoned;
+      uint64_t reportedRetired;
+      uint64_t reportedUnplaced;
+      uint64_t stalledAt;          // position of the stalled slot + 1, 0 if none
+      double stalledSince;
+
+      void append(const char *data, size_t length);
+      void writeBatch();
+      void reportLosses();
+      bool skipStalled(uint64_t position, ShmRingSlot *slot);
+
+      ShmRingCollector(const ShmRingCollector&);
+      ShmRingCollector& operator=(const ShmRingCollector&);
+
+    public:
+      // batchSize is the largest write(), at least the slot size
+      ShmRingCollector(ShmRing &ring, Print &output, size_t batchSize = 65536);
+      ~ShmRingCollector();
+
+      // writes "shmring: N records dropped/abandoned/..." lines to the output
+      // when the counters grow, true by default
+      void setReportLosses(bool enable) { report = enable; }
+
+      // moves every record available now, returns the number of records.
+      // A slot whose producer died is skipped and reused.  A slot stalled
+      // for SHMRING_STALL_TIMEOUT seconds whose producer may be alive (or
+      // is unknown) is retired: its record is lost and the slot is never
+      // used again, so the late producer can't overwrite a newer line.
+      size_t drain();
+};
+
+#endif  //_SHMRING_H_
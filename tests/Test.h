@@ -0,0 +1,26 @@
+/*
+  Test.h - Minimal checks for the unit tests, no framework needed.
+  A failed CHECK() prints its file, line and condition and the test
+  goes on; main() returns TEST_RESULT(), non-zero if any check failed.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+  License GNU Lesser General Public License v3.0.
+*/
+
+#ifndef Test_h
+#define Test_h
+
+#include <stdio.h>
+
+static int testFailures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+      testFailures++; \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+    } \
+  } while (0)
+
+#define TEST_RESULT() (testFailures ? (fprintf(stderr, "%d checks failed\n", testFailures), 1) : 0)
+
+#endif  // Test_h
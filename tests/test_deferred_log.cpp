@@ -0,0 +1,181 @@
+/*
+  test_deferred_log.cpp - DeferredLog records formatted by DeferredText,
+  and written by DeferredBinary then read back by DeferredDecoder, must
+  be the text Print writes for the same arguments, whole or fed to the
+  decoder a byte at a time.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+  License GNU Lesser General Public License v3.0.
+*/
+
+#include <limits.h>
+#include <math.h>
+#include <string>
+
+#include "../tools/DeferredLog.h"
+#include "Test.h"
+
+// Print sink keeping everything written to it
+class Capture : public Print
+{
+  public:
+    std::string text;
+
+    using Print::write;
+    size_t write(uint8_t c) { text += (char)c; return 1; }
+    size_t write(const uint8_t *buffer, size_t size) {
+      text.append((const char *)buffer, size);
+      return size;
+    }
+};
+
+// sends each record to two sinks
+class Tee : public DeferredSink
+{
+  public:
+    Tee(DeferredSink &_first, DeferredSink &_second) : first(_first), second(_second) {}
+    void record(const DeferredFormat &format, const uint8_t *payload, size_t size) {
+      first.record(format, payload, size);
+      second.record(format, payload, size);
+    }
+
+  private:
+    DeferredSink &first;
+    DeferredSink &second;
+};
+
+// records lines with every argument type and prints the same to expected
+static size_t recordLines(Print &expected, int round){
+    size_t records = 0;
+
+    DeferredLog::println("order ", round, " filled at ", 101.25);
+    expected.print("order "); expected.print(round); expected.print(" filled at "); expected.println(101.25);
+    records++;
+
+    DeferredLog::print('c', (unsigned char)200, INT_MIN, UINT_MAX, LONG_MIN, ULONG_MAX);
+    expected.print('c'); expected.print((unsigned char)200); expected.print(INT_MIN);
+    expected.print(UINT_MAX); expected.print(LONG_MIN); expected.print(ULONG_MAX);
+    records++;
+
+    DeferredLog::println(DeferredLog::number(255, HEX), ' ', DeferredLog::number(5u, BIN), ' ',
+                         DeferredLog::number(-1L, OCT), ' ', DeferredLog::number(3.14159265, 5));
+    expected.print(255, HEX); expected.print(' '); expected.print(5u, BIN); expected.print(' ');
+    expected.print(-1L, OCT); expected.print(' '); expected.println(3.14159265, 5);
+    records++;
+
+    DeferredLog::println(-0.004, ' ', 1e300, ' ', NAN, ' ', -INFINITY);
+    expected.print(-0.004); expected.print(' '); expected.print(1e300); expected.print(' ');
+    expected.print(NAN); expected.print(' '); expected.println(-INFINITY);
+    records++;
+
+    String heap("a String long enough for a heap buffer, copied when recorded");
+    StringView view("a view with a\0zero inside", 25);
+    String empty;
+    DeferredLog::println(heap, '|', view, '|', empty, '|', "");
+    expected.print(heap); expected.print('|'); expected.print(view); expected.print('|');
+    expected.print(empty); expected.print('|'); expected.println("");
+    records++;
+
+    DeferredLog::println();
+    expected.println();
+    records++;
+
+    return records;
+}
+
+static std::string decodeAll(const std::string &binary, bool &ok){
+    Capture decoded;
+    DeferredDecoder decoder(decoded);
+    size_t used = decoder.decode((const uint8_t *)binary.data(), binary.size());
+    ok = decoder.ok() && used == binary.size();
+    return decoded.text;
+}
+
+// as deferred_decode does with short reads: the undecoded tail is kept
+static std::string decodeBytewise(const std::string &binary, bool &ok){
+    Capture decoded;
+    DeferredDecoder decoder(decoded);
+    std::string pending;
+    for (size_t i = 0; i < binary.size(); i++) {
+        pending += binary[i];
+        size_t used = decoder.decode((const uint8_t *)pending.data(), pending.size());
+        pending.erase(0, used);
+    }
+    ok = decoder.ok() && pending.empty();
+    return decoded.text;
+}
+
+static void roundTrip(){
+    Capture expected, text, binary;
+    DeferredText textSink(text);
+    DeferredBinary binarySink(binary);
+    Tee tee(textSink, binarySink);
+
+    size_t records = recordLines(expected, 1);
+    CHECK(DeferredLog::drain(tee) == records);
+    CHECK(text.text == expected.text);
+
+    bool ok = false;
+    CHECK(decodeAll(binary.text, ok) == expected.text);
+    CHECK(ok);
+    CHECK(decodeBytewise(binary.text, ok) == expected.text);
+    CHECK(ok);
+
+    // a second drain only adds records, the descriptors were written once
+    size_t before = binary.text.size();
+    records = recordLines(expected, 2);
+    CHECK(DeferredLog::drain(tee) == records);
+    CHECK(text.text == expected.text);
+    CHECK(binary.text.size() > before && binary.text[before] == 'R');
+    CHECK(decodeAll(binary.text, ok) == expected.text);
+    CHECK(ok);
+
+    CHECK(DeferredLog::drain(tee) == 0);
+    CHECK(DeferredLog::dropped() == 0);
+}
+
+static void corruptInput(){
+    Capture expected, binary;
+    DeferredBinary binarySink(binary);
+    recordLines(expected, 3);
+    DeferredLog::drain(binarySink);
+    std::string data = binary.text;
+    bool ok = true;
+
+    // bad magic
+    std::string bad = data;
+    bad[0] = (char)(bad[0] ^ 0xFF);
+    decodeAll(bad, ok);
+    CHECK(!ok);
+
+    // cut in the middle of the last record: everything before decodes
+    Capture decoded;
+    DeferredDecoder decoder(decoded);
+    size_t used = decoder.decode((const uint8_t *)data.data(), data.size() - 1);
+    CHECK(decoder.ok());
+    CHECK(used < data.size() - 1);
+    CHECK(decoded.text.size() < expected.text.size());
+    CHECK(expected.text.compare(0, decoded.text.size(), decoded.text) == 0);
+
+    // a record shorter than its descriptor: an int needs 4 bytes
+    std::string shortRecord = data.substr(0, 12);
+    const char descriptor[] = {'F', 0, 0, 0, 0, 1, 1, DEFERRED_INT};
+    const char record[] = {'R', 0, 0, 0, 0, 2, 0, 0, 0, 42, 0};
+    shortRecord.append(descriptor, sizeof(descriptor));
+    shortRecord.append(record, sizeof(record));
+    decodeAll(shortRecord, ok);
+    CHECK(!ok);
+
+    // a descriptor id out of sequence, the largest possible
+    std::string farId = data.substr(0, 12);
+    const char far[] = {'F', (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, 1, 1, DEFERRED_INT};
+    farId.append(far, sizeof(far));
+    decodeAll(farId, ok);
+    CHECK(!ok);
+}
+
+int main(){
+    roundTrip();
+    corruptInput();
+    return TEST_RESULT();
+}
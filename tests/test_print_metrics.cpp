@@ -0,0 +1,80 @@
+/*
+  test_print_metrics.cpp - Print sink metrics: filled by the
+  instrumented sinks when built with OUTPUTPRINT_METRICS, zeros and a
+  single pointer per sink otherwise.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+  License GNU Lesser General Public License v3.0.
+*/
+
+#include <stdio.h>
+
+#include "../src/OutputPrint.h"
+#include "../src/BufferedPrint.h"
+#include "Test.h"
+
+// a Print that isn't instrumented
+class Discard : public Print
+{
+  public:
+    using Print::write;
+    size_t write(uint8_t) { return 1; }
+};
+
+static void outputPrint(FILE *file){
+    OutputPrint out(file);
+    out.print("twelve bytes");
+    out.write((const uint8_t *)"0123456789", 10);
+    out.flush();
+    PrintMetricsSnapshot m = out.metrics();
+#ifdef OUTPUTPRINT_METRICS
+    CHECK(m.bytes == 22);
+    CHECK(m.writes == 2);
+    CHECK(m.flushes == 1);
+    CHECK(m.syscalls == 3);   // two fwrite(), one fflush()
+    CHECK(m.errors == 0);
+    CHECK(m.writeLatency.count == 2 && m.flushLatency.count == 1);
+    out.resetMetrics();
+    CHECK(out.metrics().bytes == 0 && out.metrics().syscalls == 0);
+#else
+    CHECK(m.bytes == 0 && m.writes == 0 && m.syscalls == 0);
+#endif
+}
+
+static void bufferedPrint(FILE *file){
+    BufferedPrint out(fileno(file), 16, false);
+    out.print("0123456789");      // buffered
+    out.print("0123456789");      // flushes the first ten bytes
+    out.print("a line longer than the whole buffer");   // flush, then straight out
+    out.flush();
+    PrintMetricsSnapshot m = out.metrics();
+#ifdef OUTPUTPRINT_METRICS
+    CHECK(m.bytes == 55);
+    CHECK(m.writes == 3);
+    CHECK(m.flushes == 3);
+    CHECK(m.syscalls == 3);   // two flushes with bytes, one direct write
+#else
+    CHECK(m.bytes == 0 && m.flushes == 0 && m.syscalls == 0);
+#endif
+}
+
+int main(){
+    FILE *file = tmpfile();
+    CHECK(file != NULL);
+    if (!file) return TEST_RESULT();
+
+    outputPrint(file);
+    bufferedPrint(file);
+
+    // every Print answers, with zeros when it isn't instrumented
+    Discard discard;
+    Print &print = discard;
+    print.print("nothing counted");
+    CHECK(print.metrics().bytes == 0 && print.metrics().writes == 0);
+
+    // the metrics cost a pointer, not the counters, in every build
+    CHECK(sizeof(OutputPrint) <= sizeof(Print) + 4 * sizeof(void *));
+
+    fclose(file);
+    return TEST_RESULT();
+}
@@ -0,0 +1,166 @@
+/*
+  test_string_alloc.cpp - Pluggable String allocators: heap buffers go
+  back to the allocator they came from, moves take the buffer with its
+  allocator in O(1), and the pool can be shared by threads.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+  License GNU Lesser General Public License v3.0.
+*/
+
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../tools/WString.h"
+#include "Test.h"
+
+static const char *LONG_TEXT = "a string long enough to live in a heap buffer";
+
+// same allocator: the buffer itself moves
+static void moveSameAllocator(){
+    String a(LONG_TEXT);
+    const char *buffer = a.buffer;
+    String b(std::move(a));
+    CHECK(b.buffer == buffer);
+    CHECK(b == LONG_TEXT);
+
+    StringArena arena;
+    StringAllocatorScope scope(arena);
+    String c(LONG_TEXT);
+    buffer = c.buffer;
+    String d;
+    d = std::move(c);
+    CHECK(d.buffer == buffer);
+    CHECK(&d.allocator() == &arena);
+}
+
+static_assert(std::is_nothrow_move_constructible<String>::value, "String moves must not throw");
+static_assert(std::is_nothrow_move_assignable<String>::value, "String moves must not throw");
+
+// a move inside an arena scope takes the pointer, it allocates nothing
+static void moveIntoArenaScope(){
+    String h(LONG_TEXT);
+    const char *buffer = h.buffer;
+    StringArena arena;
+    {
+        StringAllocatorScope scope(arena);
+        String a(std::move(h));
+        CHECK(a.buffer == buffer);
+        CHECK(&a.allocator() == &StringAllocator::heap());
+        String b;
+        b = std::move(a);
+        CHECK(b.buffer == buffer);
+        h = std::move(b);
+        CHECK(arena.used() == 0);
+    }
+    arena.release();
+    CHECK(h.buffer == buffer);
+    CHECK(h == LONG_TEXT);
+}
+
+// a vector growing inside an arena scope moves its heap Strings as they are
+static void vectorGrowsInArenaScope(){
+    std::vector<String> strings;
+    strings.push_back(String(LONG_TEXT));
+    const char *buffer = strings[0].buffer;
+    {
+        StringArena arena;
+        StringAllocatorScope scope(arena);
+        for (int i = 0; i < 100; i++) strings.push_back(String("an arena string, long enough for a buffer"));
+        strings.resize(1);
+        arena.release();
+    }
+    CHECK(strings[0].buffer == buffer);
+    CHECK(strings[0] == LONG_TEXT);
+    CHECK(&strings[0].allocator() == &StringAllocator::heap());
+}
+
+// an arena buffer moved out of the scope is still arena memory
+static void moveOutOfArenaScope(){
+    StringArena arena;
+    String a;
+    {
+        StringAllocatorScope scope(arena);
+        String temp(LONG_TEXT);
+        temp += " and a bit more";
+        a = std::move(temp);
+    }
+    const char *buffer = a.buffer;
+    String b(std::move(a));
+    CHECK(b.buffer == buffer);
+    CHECK(&b.allocator() == &arena);
+    b += ", grown in the arena";
+    CHECK(&b.allocator() == &arena);
+    CHECK(b.endsWith(StringView(" and a bit more, grown in the arena")));
+}
+
+// interned buffers are shared by every allocator, moves keep them
+static void moveInterned(){
+    String key = String(LONG_TEXT).intern();
+    StringArena arena;
+    StringAllocatorScope scope(arena);
+    const char *buffer = key.buffer;
+    String moved(std::move(key));
+    CHECK(moved.isInterned());
+    CHECK(moved.buffer == buffer);
+}
+
+// replace() builds its result with the allocator of the String
+static void replaceKeepsAllocator(){
+    StringArena arena;
+    StringAllocatorScope scope(arena);
+    String s("replace inside the arena, replace it all, replace");
+    {
+        StringAllocatorScope heap(StringAllocator::heap());
+        s.replace("replace", "substitute with a longer text");
+        CHECK(&s.allocator() == &arena);
+        CHECK(s.indexOf("replace") == -1);
+
+        String find[2] = {String("substitute"), String("arena")};
+        String with[2] = {String("put"), String("pool of chunks")};
+        s.replace(find, with, 2);
+        CHECK(&s.allocator() == &arena);
+        CHECK(s.indexOf("pool of chunks") != -1);
+    }
+}
+
+// buffers of a shared pool allocated and freed on different threads
+static void poolAcrossThreads(){
+    StringPoolAllocator pool;
+    const int THREADS = 4;
+    const int ROUNDS = 2000;
+    String made[THREADS];
+    std::thread threads[THREADS];
+    bool ok[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        threads[t] = std::thread([&pool, &made, &ok, t]() {
+            StringAllocatorScope scope(pool);
+            ok[t] = true;
+            for (int i = 0; i < ROUNDS; i++) {
+                String s(LONG_TEXT);
+                s += String(i);
+                ok[t] = ok[t] && &s.allocator() == &pool && s.startsWith(StringView(LONG_TEXT));
+            }
+            made[t] = String(LONG_TEXT);
+        });
+    }
+    for (int t = 0; t < THREADS; t++) threads[t].join();
+    for (int t = 0; t < THREADS; t++) {
+        CHECK(ok[t]);
+        CHECK(&made[t].allocator() == &pool);
+        CHECK(made[t] == LONG_TEXT);
+        made[t] = String();     // the pool buffer is freed by this thread
+    }
+}
+
+int main(){
+    moveSameAllocator();
+    moveIntoArenaScope();
+    vectorGrowsInArenaScope();
+    moveOutOfArenaScope();
+    moveInterned();
+    replaceKeepsAllocator();
+    poolAcrossThreads();
+    return TEST_RESULT();
+}
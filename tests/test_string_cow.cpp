@@ -0,0 +1,107 @@
+/*
+  test_string_cow.cpp - Copy-on-write String buffers: copies share a heap
+  buffer until one of them is modified, and a char& from the non-const
+  operator[] never writes into a buffer another String can see.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+  License GNU Lesser General Public License v3.0.
+*/
+
+#include "../tools/WString.h"
+#include "Test.h"
+
+static const char *LONG_TEXT = "a string long enough to live in a heap buffer";
+
+static void copiesShare(){
+    String a(LONG_TEXT);
+    String b = a;
+    CHECK(a.buffer == b.buffer);
+    CHECK(a.isShared() && b.isShared());
+
+    b += "!";
+    CHECK(a.buffer != b.buffer);
+    CHECK(a == LONG_TEXT);
+    CHECK(!a.isShared());
+
+    String c = a;
+    c.setCharAt(0, 'X');
+    CHECK(a == LONG_TEXT);
+    CHECK(c[0] == 'X');
+
+    String d = a;
+    d.replace('a', 'A');
+    CHECK(a == LONG_TEXT);
+    CHECK(d.indexOf('a') == -1);
+}
+
+// a reference taken before the copy must not write into the copy
+static void referenceBeforeCopy(){
+    String a(LONG_TEXT);
+    char &r = a[0];
+    String b = a;
+    String c;
+    c = a;
+    r = 'X';
+    CHECK(a[0] == 'X');
+    CHECK(b == LONG_TEXT);
+    CHECK(c == LONG_TEXT);
+    CHECK(a.buffer != b.buffer && a.buffer != c.buffer);
+}
+
+// a reference taken from a shared buffer writes into a private duplicate
+static void referenceAfterCopy(){
+    String a(LONG_TEXT);
+    String b = a;
+    char &r = a[1];
+    r = '!';
+    CHECK(a[1] == '!');
+    CHECK(b == LONG_TEXT);
+    CHECK(!b.isShared());
+}
+
+// the const operator[] only reads and keeps the buffer shared
+static void constAccessShares(){
+    String a(LONG_TEXT);
+    const String &ca = a;
+    CHECK(ca[0] == 'a');
+    String b = a;
+    CHECK(a.buffer == b.buffer);
+}
+
+// inline strings are always copied, references into them are private
+static void inlineStrings(){
+    String a("short");
+    CHECK(a.isInline());
+    char &r = a[0];
+    String b = a;
+    r = 'S';
+    CHECK(a == "Short");
+    CHECK(b == "short");
+}
+
+// writes through a reference are seen by hash() and the UTF-8 class
+static void cachesSeeReferenceWrites(){
+    String a(LONG_TEXT);
+    char &r = a[0];
+    uint64_t before = a.hash();
+    CHECK(a.isAscii());
+    r = 'X';
+    CHECK(a.hash() != before);
+    CHECK(a.hash() == a.view().hash());
+    r = (char)0xC3;
+    CHECK(!a.isAscii());
+    CHECK(!a.isValidUtf8());
+    r = 'a';
+    CHECK(a.hash() == before);
+    CHECK(a.isAscii());
+}
+
+int main(){
+    copiesShare();
+    referenceBeforeCopy();
+    referenceAfterCopy();
+    constAccessShares();
+    inlineStrings();
+    cachesSeeReferenceWrites();
+    return TEST_RESULT();
+}
@@ -0,0 +1,275 @@
+/*
+  test_string_kernels.cpp - The StringKernels (SSE2 when the target has
+  it) against plain scalar code, at every length up to a few vectors and
+  every alignment, with matches at the first and last byte and the bytes
+  around the buffer set to what is searched for, so a kernel reading
+  past either end is caught.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+  License GNU Lesser General Public License v3.0.
+*/
+
+#include <string.h>
+
+#include "../tools/StringKernels.h"
+#include "Test.h"
+
+static const size_t MAX_LENGTH = 80;
+static const size_t MAX_OFFSET = 16;
+static const size_t GUARD = 32;
+
+// the buffer under test is s[0, n), surrounded by guard bytes
+struct Buffer
+{
+    char storage[GUARD + MAX_OFFSET + MAX_LENGTH + GUARD];
+    char *s;
+    size_t n;
+
+    Buffer(size_t offset, size_t length, char fill, char guard){
+        memset(storage, guard, sizeof(storage));
+        s = storage + GUARD + offset;
+        n = length;
+        for (size_t i = 0; i < n; i++) s[i] = (char)(fill + (char)(i % 3));
+    }
+    Buffer(const Buffer &other){
+        memcpy(storage, other.storage, sizeof(storage));
+        s = storage + (other.s - other.storage);
+        n = other.n;
+    }
+};
+
+// reference implementations
+
+static const char *refFindByte(const char *s, size_t n, char c){
+    for (size_t i = 0; i < n; i++) if (s[i] == c) return s + i;
+    return NULL;
+}
+
+static const char *refFindLastByte(const char *s, size_t n, char c){
+    for (size_t i = n; i > 0; i--) if (s[i - 1] == c) return s + i - 1;
+    return NULL;
+}
+
+static const char *refFindBytes(const char *s, size_t n, const char *needle, size_t nlen){
+    if (nlen > n) return NULL;
+    for (size_t i = 0; i + nlen <= n; i++) if (memcmp(s + i, needle, nlen) == 0) return s + i;
+    return NULL;
+}
+
+static const char *refFindLastBytes(const char *s, size_t n, const char *needle, size_t nlen){
+    if (nlen > n) return NULL;
+    for (size_t i = n - nlen + 1; i > 0; i--) if (memcmp(s + i - 1, needle, nlen) == 0) return s + i - 1;
+    return NULL;
+}
+
+static const char *refFindAnyByte(const char *s, size_t n, const char *set, size_t setlen){
+    for (size_t i = 0; i < n; i++) if (memchr(set, s[i], setlen)) return s + i;
+    return NULL;
+}
+
+static char refLower(char c){
+    return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+static char refUpper(char c){
+    return (c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c;
+}
+
+static bool refIsSpace(char c){
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+static size_t refCountByte(const char *s, size_t n, char c){
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) if (s[i] == c) count++;
+    return count;
+}
+
+// positions where the tests put a match: the edges and the middle
+static size_t positions(size_t n, size_t *at){
+    size_t count = 0;
+    if (n == 0) return 0;
+    at[count++] = 0;
+    if (n > 2) at[count++] = n / 2;
+    if (n > 1) at[count++] = n - 1;
+    return count;
+}
+
+static void bytes(){
+    for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+        for (size_t n = 0; n <= MAX_LENGTH; n++) {
+            Buffer b(offset, n, 'a', 'z');
+            CHECK(StringKernels::findByte(b.s, n, 'z') == NULL);
+            CHECK(StringKernels::findLastByte(b.s, n, 'z') == NULL);
+            CHECK(StringKernels::countByte(b.s, n, 'z') == 0);
+            CHECK(StringKernels::findByte(b.s, n, 'a') == refFindByte(b.s, n, 'a'));
+            CHECK(StringKernels::findLastByte(b.s, n, 'c') == refFindLastByte(b.s, n, 'c'));
+            CHECK(StringKernels::countByte(b.s, n, 'b') == refCountByte(b.s, n, 'b'));
+
+            size_t at[3];
+            size_t count = positions(n, at);
+            for (size_t i = 0; i < count; i++) {
+                Buffer m(offset, n, 'a', 'z');
+                m.s[at[i]] = 'z';
+                CHECK(StringKernels::findByte(m.s, n, 'z') == m.s + at[i]);
+                CHECK(StringKernels::findLastByte(m.s, n, 'z') == m.s + at[i]);
+                CHECK(StringKernels::countByte(m.s, n, 'z') == 1);
+                // high bytes compare as bytes, not as signed chars
+                m.s[at[i]] = (char)0xFF;
+                CHECK(StringKernels::findByte(m.s, n, (char)0xFF) == m.s + at[i]);
+                CHECK(StringKernels::findLastByte(m.s, n, (char)0xFF) == m.s + at[i]);
+            }
+            if (n > 1) {
+                Buffer m(offset, n, 'a', 'z');
+                m.s[0] = m.s[n - 1] = 'z';
+                CHECK(StringKernels::findByte(m.s, n, 'z') == m.s);
+                CHECK(StringKernels::findLastByte(m.s, n, 'z') == m.s + n - 1);
+                CHECK(StringKernels::countByte(m.s, n, 'z') == 2);
+            }
+        }
+    }
+}
+
+static void sets(){
+    // short sets and one longer than a vector
+    const char *set = "z,;\t0123456789ABCDEFGHIJ";
+    const size_t lengths[] = {1, 2, 3, 4, strlen(set)};
+    for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+        for (size_t n = 0; n <= MAX_LENGTH; n++) {
+            for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+                size_t setlen = lengths[l];
+                Buffer b(offset, n, 'a', set[setlen - 1]);
+                CHECK(StringKernels::findAnyByte(b.s, n, set, setlen) == NULL);
+
+                size_t at[3];
+                size_t count = positions(n, at);
+                for (size_t i = 0; i < count; i++) {
+                    Buffer m(offset, n, 'a', set[0]);
+                    m.s[at[i]] = set[setlen - 1];
+                    CHECK(StringKernels::findAnyByte(m.s, n, set, setlen) == m.s + at[i]);
+                    CHECK(StringKernels::findAnyByte(m.s, n, set, setlen) ==
+                          refFindAnyByte(m.s, n, set, setlen));
+                }
+            }
+        }
+    }
+}
+
+static void needles(){
+    const char *needle = "zzyzx";
+    for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+        for (size_t n = 0; n <= MAX_LENGTH; n++) {
+            for (size_t nlen = 0; nlen <= 5; nlen++) {
+                // the needle only in the guard bytes
+                Buffer b(offset, n, 'a', 'z');
+                CHECK(StringKernels::findBytes(b.s, n, needle, nlen) == refFindBytes(b.s, n, needle, nlen));
+                CHECK(StringKernels::findLastBytes(b.s, n, needle, nlen) ==
+                      refFindLastBytes(b.s, n, needle, nlen));
+                if (nlen == 0 || nlen > n) continue;
+
+                // at every position, including across vector boundaries
+                for (size_t at = 0; at + nlen <= n; at++) {
+                    Buffer m(offset, n, 'a', 'z');
+                    memcpy(m.s + at, needle, nlen);
+                    CHECK(StringKernels::findBytes(m.s, n, needle, nlen) == m.s + at);
+                    CHECK(StringKernels::findLastBytes(m.s, n, needle, nlen) == m.s + at);
+                }
+
+                // a prefix cut by the end, and by the start for the last one
+                Buffer cut(offset, n, 'a', 'x');
+                memcpy(cut.s + n - (nlen - 1), needle, nlen - 1);
+                CHECK(StringKernels::findBytes(cut.s, n, needle, nlen) == refFindBytes(cut.s, n, needle, nlen));
+                Buffer tail(offset, n, 'a', 'z');
+                memcpy(tail.s, needle + 1, nlen - 1);
+                CHECK(StringKernels::findLastBytes(tail.s, n, needle, nlen) ==
+                      refFindLastBytes(tail.s, n, needle, nlen));
+
+                // repeated first bytes before the match
+                Buffer rep(offset, n, 'a', 'z');
+                memset(rep.s, 'z', n);
+                rep.s[n - 1] = 'q';
+                const char repeated[] = "zzzzq";
+                const char *last = repeated + 5 - nlen;
+                CHECK(StringKernels::findBytes(rep.s, n, last, nlen) == refFindBytes(rep.s, n, last, nlen));
+                CHECK(StringKernels::findLastBytes(rep.s, n, repeated, nlen) ==
+                      refFindLastBytes(rep.s, n, repeated, nlen));
+            }
+        }
+    }
+}
+
+// every byte value through the case kernels, the guard bytes untouched
+static void cases(){
+    for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+        for (size_t n = 0; n <= MAX_LENGTH; n++) {
+            for (unsigned first = 0; first < 256; first += (unsigned)(n ? n : 256)) {
+                Buffer lower(offset, n, 'a', 'G');
+                for (size_t i = 0; i < n; i++) lower.s[i] = (char)(first + i);
+                Buffer upper(lower);
+                Buffer original(lower);
+
+                StringKernels::toLowerAscii(lower.s, n);
+                StringKernels::toUpperAscii(upper.s, n);
+                bool same = true;
+                for (size_t i = 0; i < n; i++) {
+                    same = same && lower.s[i] == refLower(original.s[i]);
+                    same = same && upper.s[i] == refUpper(original.s[i]);
+                }
+                CHECK(same);
+                CHECK(lower.s[-1] == 'G' && lower.s[n] == 'G');
+                CHECK(upper.s[-1] == 'G' && upper.s[n] == 'G');
+
+                CHECK(StringKernels::equalsIgnoreCaseAscii(lower.s, upper.s, n));
+                CHECK(StringKernels::equalsIgnoreCaseAscii(original.s, upper.s, n));
+                size_t at[3];
+                size_t count = positions(n, at);
+                for (size_t i = 0; i < count; i++) {
+                    char saved = upper.s[at[i]];
+                    upper.s[at[i]] = (char)(saved ^ 0x01);
+                    CHECK(!StringKernels::equalsIgnoreCaseAscii(lower.s, upper.s, n));
+                    // letters only differ by case: 0x20 alone is no match elsewhere
+                    upper.s[at[i]] = (char)(saved ^ 0x20);
+                    bool letter = refLower(saved) != refUpper(saved);
+                    CHECK(StringKernels::equalsIgnoreCaseAscii(lower.s, upper.s, n) == letter);
+                    upper.s[at[i]] = saved;
+                }
+            }
+        }
+    }
+}
+
+// whitespace spans stop at the first other byte, and at the length
+static void spaces(){
+    const char *space = " \t\n\v\f\r";
+    for (size_t offset = 0; offset < MAX_OFFSET; offset++) {
+        for (size_t n = 0; n <= MAX_LENGTH; n++) {
+            Buffer b(offset, n, 'a', ' ');
+            CHECK(StringKernels::spanSpace(b.s, n) == 0);
+            CHECK(StringKernels::spanSpaceBack(b.s, n) == 0);
+            for (size_t k = 0; k <= n; k++) {
+                Buffer m(offset, n, 'a', ' ');
+                for (size_t i = 0; i < k; i++) m.s[i] = space[i % 6];
+                for (size_t i = 0; i < k; i++) m.s[n - 1 - i] = space[(i + 3) % 6];
+                size_t lead = 0, trail = 0;
+                while (lead < n && refIsSpace(m.s[lead])) lead++;
+                while (trail < n && refIsSpace(m.s[n - 1 - trail])) trail++;
+                CHECK(StringKernels::spanSpace(m.s, n) == lead);
+                CHECK(StringKernels::spanSpaceBack(m.s, n) == trail);
+            }
+            // bytes next to the whitespace characters are not spaces
+            Buffer near(offset, n, 'a', ' ');
+            for (size_t i = 0; i < n; i++) near.s[i] = "\x08\x0e\x1f!\x85\xa0"[i % 6];
+            CHECK(StringKernels::spanSpace(near.s, n) == 0);
+            CHECK(StringKernels::spanSpaceBack(near.s, n) == 0);
+        }
+    }
+}
+
+int main(){
+    bytes();
+    sets();
+    needles();
+    cases();
+    spaces();
+    return TEST_RESULT();
+}
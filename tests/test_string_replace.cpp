@@ -0,0 +1,120 @@
+/*
+  test_string_replace.cpp - String::replace() of one and of several
+  find/replace pairs against a plain reference on random text over a
+  small alphabet, so finds overlap, share prefixes and repeat.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+  License GNU Lesser General Public License v3.0.
+*/
+
+#include <string>
+#include <vector>
+
+#include "../tools/WString.h"
+#include "Test.h"
+
+// leftmost, then longest find, then first in array order
+static std::string refReplace(const std::string &s, const std::vector<std::string> &find,
+                              const std::vector<std::string> &with){
+    std::string out;
+    size_t i = 0;
+    while (i < s.size()) {
+        size_t best = find.size();
+        for (size_t k = 0; k < find.size(); k++) {
+            if (find[k].empty() || s.compare(i, find[k].size(), find[k]) != 0) continue;
+            if (best == find.size() || find[k].size() > find[best].size()) best = k;
+        }
+        if (best == find.size()) {
+            out += s[i++];
+            continue;
+        }
+        out += with[best];
+        i += find[best].size();
+    }
+    return out;
+}
+
+static unsigned long seed = 12345;
+
+static unsigned long nextRandom(){
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    return seed >> 33;
+}
+
+// a byte of a small alphabet with a zero and a high byte in it
+static char randomByte(){
+    static const char alphabet[] = {'a', 'b', 'c', '\0', (char)0xC3};
+    return alphabet[nextRandom() % sizeof(alphabet)];
+}
+
+static std::string randomText(size_t maxLength){
+    std::string s;
+    size_t n = nextRandom() % (maxLength + 1);
+    for (size_t i = 0; i < n; i++) s += randomByte();
+    return s;
+}
+
+static String toString(const std::string &s){
+    String r;
+    r.concat(StringView(s.data(), s.size()));
+    return r;
+}
+
+static bool same(const String &s, const std::string &expected){
+    return s.length() == expected.size() && s.view() == StringView(expected.data(), expected.size());
+}
+
+static void randomPairs(size_t pairs){
+    bool ok = true;
+    for (int round = 0; round < 2000; round++) {
+        std::vector<std::string> find, with;
+        String finds[40], withs[40];
+        for (size_t k = 0; k < pairs; k++) {
+            find.push_back(randomText(3));
+            with.push_back(randomText(4));
+            finds[k] = toString(find[k]);
+            withs[k] = toString(with[k]);
+        }
+        std::string text = randomText(200);
+        String s = toString(text);
+        s.replace(finds, withs, (unsigned int)pairs);
+        ok = ok && same(s, refReplace(text, find, with));
+
+        // the single pair replace agrees too
+        String one = toString(text);
+        one.replace(finds[0], withs[0]);
+        ok = ok && same(one, refReplace(text, std::vector<std::string>(1, find[0]),
+                                        std::vector<std::string>(1, with[0])));
+    }
+    CHECK(ok);
+}
+
+static void longestFirst(){
+    String s("abcabxab");
+    String find[3] = {String("ab"), String("abc"), String("a")};
+    String with[3] = {String("2"), String("3"), String("1")};
+    s.replace(find, with, 3);
+    CHECK(s == "32x2");
+
+    // same length: array order
+    String t("xyz");
+    String f2[2] = {String("xy"), String("xy")};
+    String w2[2] = {String("first"), String("second")};
+    t.replace(f2, w2, 2);
+    CHECK(t == "firstz");
+
+    // empty finds and invalid replacements are skipped
+    String u("keep this");
+    String f3[3] = {String(""), String("this"), String("keep")};
+    String w3[3] = {String("never"), String("that"), String()};
+    w3[2].invalidate();
+    u.replace(f3, w3, 3);
+    CHECK(u == "keep that");
+}
+
+int main(){
+    for (size_t pairs = 1; pairs <= 6; pairs++) randomPairs(pairs);
+    randomPairs(40);     // more pairs than fit in the local table
+    longestFirst();
+    return TEST_RESULT();
+}
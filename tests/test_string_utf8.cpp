@@ -0,0 +1,218 @@
+/*
+  test_string_utf8.cpp - UTF-8 validation, code point indexing and safe
+  truncation against a reference decoder written from the Unicode
+  well-formed byte sequences table: every first and second byte, cut
+  sequences, overlong forms, surrogates and the U+10FFFF limit, after
+  ASCII runs of every length so the vector loops end at each position.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+  License GNU Lesser General Public License v3.0.
+*/
+
+#include <string.h>
+#include <string>
+
+#include "../tools/StringKernels.h"
+#include "../tools/WString.h"
+#include "Test.h"
+
+// length of the well-formed sequence at p, 0 if malformed or cut
+static size_t refSequence(const unsigned char *p, size_t n){
+    unsigned char c = p[0];
+    if (c < 0x80) return 1;
+    size_t k;
+    unsigned char low = 0x80, high = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) k = 2;
+    else if (c == 0xE0) { k = 3; low = 0xA0; }
+    else if (c == 0xED) { k = 3; high = 0x9F; }
+    else if (c >= 0xE1 && c <= 0xEF) k = 3;
+    else if (c == 0xF0) { k = 4; low = 0x90; }
+    else if (c >= 0xF1 && c <= 0xF3) k = 4;
+    else if (c == 0xF4) { k = 4; high = 0x8F; }
+    else return 0;
+    if (n < k || p[1] < low || p[1] > high) return 0;
+    for (size_t i = 2; i < k; i++) if ((p[i] & 0xC0) != 0x80) return 0;
+    return k;
+}
+
+static size_t refSpanUtf8(const char *s, size_t n){
+    size_t i = 0;
+    while (i < n) {
+        size_t k = refSequence((const unsigned char *)s + i, n - i);
+        if (!k) break;
+        i += k;
+    }
+    return i;
+}
+
+static size_t refSpanAscii(const char *s, size_t n){
+    size_t i = 0;
+    while (i < n && (unsigned char)s[i] < 0x80) i++;
+    return i;
+}
+
+static long refCodePoint(const char *s, size_t n){
+    const unsigned char *p = (const unsigned char *)s;
+    size_t k = n ? refSequence(p, n) : 0;
+    if (!k) return -1;
+    if (k == 1) return p[0];
+    long c = p[0] & (0x7F >> k);
+    for (size_t i = 1; i < k; i++) c = (c << 6) | (p[i] & 0x3F);
+    return c;
+}
+
+// every first and second byte, with continuation and other bytes after
+static void everySequence(){
+    const unsigned char tails[] = {0x41, 0x80, 0x8F, 0x90, 0xBF, 0xC0};
+    const size_t TAILS = sizeof(tails);
+    bool same = true;
+    for (unsigned first = 0; first < 256; first++) {
+        for (unsigned second = 0; second < 256; second++) {
+            for (size_t t = 0; t < TAILS * TAILS; t++) {
+                char s[4] = {(char)first, (char)second, (char)tails[t / TAILS], (char)tails[t % TAILS]};
+                for (size_t n = 1; n <= 4; n++) {
+                    same = same && StringKernels::spanUtf8(s, n) == refSpanUtf8(s, n);
+                    same = same && StringKernels::codePointAt(s, n) == refCodePoint(s, n);
+                }
+            }
+        }
+    }
+    CHECK(same);
+}
+
+static const char *const SEQUENCES[] = {
+    // well-formed: the first and last code point of each length
+    "\xC2\x80", "\xDF\xBF", "\xE0\xA0\x80", "\xEF\xBF\xBF",
+    "\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF",
+    // around the surrogates
+    "\xED\x9F\xBF", "\xEE\x80\x80",
+    // overlong forms
+    "\xC0\x80", "\xC1\xBF", "\xE0\x80\x80", "\xE0\x9F\xBF", "\xF0\x80\x80\x80", "\xF0\x8F\xBF\xBF",
+    // surrogates
+    "\xED\xA0\x80", "\xED\xBF\xBF",
+    // above U+10FFFF, and bytes that never start a sequence
+    "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xF8\x88\x80\x80\x80", "\xFF", "\x80", "\xBF",
+    // cut sequences
+    "\xC3", "\xE2\x82", "\xF0\x9F\x98",
+};
+
+// each sequence after and before ASCII runs, and cut by the end
+static void sequencesAtEveryPosition(){
+    bool same = true;
+    for (size_t k = 0; k < sizeof(SEQUENCES) / sizeof(SEQUENCES[0]); k++) {
+        const char *sequence = SEQUENCES[k];
+        for (size_t before = 0; before <= 40; before++) {
+            for (size_t after = 0; after <= 20; after++) {
+                std::string s(before, 'a');
+                s += sequence;
+                s.append(after, 'b');
+                for (size_t n = before; n <= s.size(); n++) {
+                    same = same && StringKernels::spanUtf8(s.data(), n) == refSpanUtf8(s.data(), n);
+                    same = same && StringKernels::spanAscii(s.data(), n) == refSpanAscii(s.data(), n);
+                }
+            }
+        }
+    }
+    CHECK(same);
+}
+
+// runs of multibyte characters crossing the vector boundaries
+static void multibyteRuns(){
+    const char *chars[] = {"\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80"};
+    bool same = true;
+    for (size_t count = 0; count <= 40; count++) {
+        for (size_t skew = 0; skew < 16; skew++) {
+            std::string s(skew, 'a');
+            size_t points = skew;
+            for (size_t i = 0; i < count; i++, points++) s += chars[(i + skew) % 3];
+            same = same && StringKernels::spanUtf8(s.data(), s.size()) == s.size();
+            same = same && StringKernels::countCodePoints(s.data(), s.size()) == points;
+            for (size_t i = 0; i <= points; i++) {
+                size_t at = StringKernels::codePointOffset(s.data(), s.size(), i);
+                same = same && (i == points ? at == s.size() : refSequence((const unsigned char *)s.data() + at, s.size() - at) != 0);
+                same = same && (at == 0 || at == s.size() || ((unsigned char)s[at] & 0xC0) != 0x80);
+            }
+            // a malformed byte at the end, and a cut character
+            std::string bad = s + "\xFF";
+            same = same && StringKernels::spanUtf8(bad.data(), bad.size()) == s.size();
+            std::string cut = s + "\xF0\x9F";
+            same = same && StringKernels::spanUtf8(cut.data(), cut.size()) == s.size();
+        }
+    }
+    CHECK(same);
+}
+
+static void codePoints(){
+    String s("a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80\xF4\x8F\xBF\xBFz");
+    CHECK(s.isValidUtf8());
+    CHECK(!s.isAscii());
+    CHECK(s.utf8Length() == 6);
+    CHECK(s.utf8CharAt(0) == 'a');
+    CHECK(s.utf8CharAt(1) == 0xE9);
+    CHECK(s.utf8CharAt(2) == 0x20AC);
+    CHECK(s.utf8CharAt(3) == 0x1F600);
+    CHECK(s.utf8CharAt(4) == 0x10FFFF);
+    CHECK(s.utf8CharAt(5) == 'z');
+    CHECK(s.utf8CharAt(6) == -1);
+    CHECK(s.utf8Subview(1, 3) == StringView("\xC3\xA9\xE2\x82\xAC"));
+    CHECK(s.utf8Subview(5) == StringView("z"));
+    CHECK(s.utf8Subview(6).length() == 0);
+    CHECK(s.utf8Subview(3, 100) == StringView("\xF0\x9F\x98\x80\xF4\x8F\xBF\xBFz"));
+    CHECK(s.utf8Substring(4, 2) == "\xE2\x82\xAC\xF0\x9F\x98\x80");
+
+    String ascii("plain ASCII text, longer than the inline storage");
+    CHECK(ascii.isAscii() && ascii.isValidUtf8());
+    CHECK(ascii.utf8Length() == ascii.length());
+    CHECK(ascii.utf8CharAt(ascii.length() - 1) == 'e');
+    CHECK(ascii.utf8CharAt(ascii.length()) == -1);
+    CHECK(ascii.utf8Subview(6, 11) == StringView("ASCII"));
+
+    String bad("abc\xED\xA0\x80");
+    CHECK(!bad.isValidUtf8());
+    CHECK(bad.utf8CharAt(3) == -1);
+}
+
+// truncation never splits a character and keeps as much as fits
+static void truncation(){
+    const std::string text = "ab\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80" "cd, and enough to be on the heap";
+    for (size_t max = 0; max <= text.size() + 1; max++) {
+        String s(text.c_str());
+        s.hash();
+        s.isValidUtf8();
+        s.utf8Truncate(max);
+        size_t fits = 0;
+        while (fits < text.size()) {
+            size_t k = refSequence((const unsigned char *)text.data() + fits, text.size() - fits);
+            if (fits + k > max) break;
+            fits += k;
+        }
+        CHECK(s.length() == fits);
+        CHECK(memcmp(s.c_str(), text.data(), fits) == 0 && s.c_str()[fits] == 0);
+        CHECK(s.isValidUtf8());
+        CHECK(s.hash() == s.view().hash());
+        CHECK(String(text.c_str()).utf8Prefix(max).length() == fits);
+    }
+
+    // a cut character at the end goes away, and the UTF-8 class follows
+    String cut("a heap string ending with a cut euro sign \xE2\x82");
+    CHECK(!cut.isValidUtf8());
+    cut.utf8Truncate(cut.length() - 1);
+    CHECK(cut.endsWith(StringView("sign ")));
+    CHECK(cut.isValidUtf8() && cut.isAscii());
+
+    // truncating one copy leaves the other alone
+    String shared(text.c_str());
+    String copy = shared;
+    shared.utf8Truncate(3);
+    CHECK(shared == "ab");
+    CHECK(copy == text.c_str());
+}
+
+int main(){
+    everySequence();
+    sequencesAtEveryPosition();
+    multibyteRuns();
+    codePoints();
+    truncation();
+    return TEST_RESULT();
+}
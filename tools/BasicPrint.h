@@ -0,0 +1,229 @@
+/*
+  BasicPrint.h - print() and println() resolved at compile time (CRTP)
+  for sinks on hot paths, with adapters to and from the virtual Print.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef BasicPrint_h
+#define BasicPrint_h
+
+#include "Print.h"
+
+// Makes a sink usable where a Print& is expected, for example by
+// Printable::printTo()
+template <class Sink>
+class PrintAdapter : public Print
+{
+  private:
+    Sink &sink;
+
+  public:
+    explicit PrintAdapter(Sink &s) : sink(s) {}
+
+    using Print::write;
+    size_t write(uint8_t c) { return sink.write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) { return sink.write(buffer, size); }
+    uint8_t *reserveWrite(size_t size) { return sink.reserveWrite(size); }
+    size_t commitWrite(size_t size) { return sink.commitWrite(size); }
+};
+
+// BasicPrint<Sink> provides the print() and println() overloads of Print
+// to a Sink class deriving from it:
+//
+//     class Sink : public BasicPrint<Sink> {
+//       public:
+//         using BasicPrint<Sink>::write;
+//         size_t write(const uint8_t *buffer, size_t size);
+//     };
+//
+// Every call goes straight to Sink::write(), which the compiler can
+// inline into the formatting code, instead of going through the virtual
+// Print::write(uint8_t) byte by byte.  Numbers are formatted on the
+// stack and written at once, println() includes the "\r\n" in the same
+// write when it can.  The output is the same as Print's.
+//
+// A Sink with a buffer of its own may also define reserveWrite() and
+// commitWrite(), as in Print, to let Printables render straight into it.
+template <class Sink>
+class BasicPrint
+{
+  private:
+    Sink &sink() { return static_cast<Sink &>(*this); }
+
+    size_t writeBytes(const char *buffer, size_t size) {
+      return sink().write((const uint8_t *)buffer, size);
+    }
+
+    size_t printUnsigned(unsigned long n, int base, bool newline) {
+      char buf[PrintFormat::NUMBER_SIZE + 2];
+      char *end = buf + PrintFormat::NUMBER_SIZE;
+      char *str;
+      if (base == 0) {
+        str = end - 1;
+        *str = (char)n;
+      } else {
+        str = PrintFormat::formatNumber(end, n, base);
+      }
+      if (newline) { *end++ = '\r'; *end++ = '\n'; }
+      return writeBytes(str, (size_t)(end - str));
+    }
+
+    size_t printSigned(long n, int base, bool newline) {
+      if (base != 10 || n >= 0) return printUnsigned((unsigned long)n, base, newline);
+      char buf[PrintFormat::NUMBER_SIZE + 2];
+      char *end = buf + PrintFormat::NUMBER_SIZE;
+      char *str = PrintFormat::formatNumber(end, 0UL - (unsigned long)n, 10);
+      *--str = '-';
+      if (newline) { *end++ = '\r'; *end++ = '\n'; }
+      return writeBytes(str, (size_t)(end - str));
+    }
+
+    size_t printFloat(double number, int digits, bool newline) {
+      char local[64];
+      size_t size = PrintFormat::floatSize(digits) + 2;
+      char *buf = size <= sizeof(local) ? local : (char *)malloc(size);
+      if (!buf) return 0;
+      size_t len = PrintFormat::formatFloat(buf, number, digits);
+      if (newline) { buf[len++] = '\r'; buf[len++] = '\n'; }
+      size_t n = writeBytes(buf, len);
+      if (buf != local) free(buf);
+      return n;
+    }
+
+  public:
+    // no buffer of its own by default, see Print::reserveWrite()
+    uint8_t *reserveWrite(size_t) { return NULL; }
+    size_t commitWrite(size_t) { return 0; }
+
+    size_t write(uint8_t c) { return sink().write(&c, 1); }
+    size_t write(const char *str) {
+      if (str == NULL) return 0;
+      return writeBytes(str, strlen(str));
+    }
+
+    size_t print(const String &s) { return s.c_str() ? writeBytes(s.c_str(), s.length()) : 0; }
+    size_t print(const StringView &v) { return writeBytes(v.data(), v.length()); }
+    size_t print(const char str[]) { return write(str); }
+    size_t print(char c) { return writeBytes(&c, 1); }
+    size_t print(unsigned char b, int base = DEC) { return printUnsigned(b, base, false); }
+    size_t print(int n, int base = DEC) { return printSigned(n, base, false); }
+    size_t print(unsigned int n, int base = DEC) { return printUnsigned(n, base, false); }
+    size_t print(long n, int base = DEC) { return printSigned(n, base, false); }
+    size_t print(unsigned long n, int base = DEC) { return printUnsigned(n, base, false); }
+    size_t print(double n, int digits = 2) { return printFloat(n, digits, false); }
+    size_t print(const Printable &x) {
+      size_t hint = x.printedSizeHint();
+      if (hint > 0) {
+        uint8_t *dst = sink().reserveWrite(hint);
+        if (dst) {
+          size_t n = x.printToBuffer((char *)dst, hint);
+          if (n > 0) return sink().commitWrite(n);
+          sink().commitWrite(0);
+        } else if (hint <= PRINT_STACK_BUFFER_SIZE) {
+          char buf[PRINT_STACK_BUFFER_SIZE];
+          size_t n = x.printToBuffer(buf, hint);
+          if (n > 0) return writeBytes(buf, n);
+        }
+      }
+      PrintAdapter<Sink> adapter(sink());
+      return x.printTo(adapter);
+    }
+
+    size_t println(void) { return writeBytes("\r\n", 2); }
+    size_t println(const String &s) { size_t n = print(s); return n + println(); }
+    size_t println(const StringView &v) { size_t n = print(v); return n + println(); }
+    size_t println(const char c[]) { size_t n = print(c); return n + println(); }
+    size_t println(char c) { char buf[3] = {c, '\r', '\n'}; return writeBytes(buf, 3); }
+    size_t println(unsigned char b, int base = DEC) { return printUnsigned(b, base, true); }
+    size_t println(int num, int base = DEC) { return printSigned(num, base, true); }
+    size_t println(unsigned int num, int base = DEC) { return printUnsigned(num, base, true); }
+    size_t println(long num, int base = DEC) { return printSigned(num, base, true); }
+    size_t println(unsigned long num, int base = DEC) { return printUnsigned(num, base, true); }
+    size_t println(double num, int digits = 2) { return printFloat(num, digits, true); }
+    size_t println(const Printable &x) { size_t n = print(x); return n + println(); }
+};
+
+// A sink over any Print, so code written for BasicPrint sinks also runs
+// on the existing Print classes
+class PrintSink : public BasicPrint<PrintSink>
+{
+  private:
+    Print &output;
+
+  public:
+    explicit PrintSink(Print &p) : output(p) {}
+
+    using BasicPrint<PrintSink>::write;
+    size_t write(const uint8_t *buffer, size_t size) { return output.write(buffer, size); }
+    uint8_t *reserveWrite(size_t size) { return output.reserveWrite(size); }
+    size_t commitWrite(size_t size) { return output.commitWrite(size); }
+};
+
+// Appends to a String
+class StringPrint : public BasicPrint<StringPrint>
+{
+  private:
+    String &target;
+
+  public:
+    explicit StringPrint(String &s) : target(s) {}
+
+    using BasicPrint<StringPrint>::write;
+    size_t write(const uint8_t *buffer, size_t size) {
+      return target.concat(StringView((const char *)buffer, size)) ? size : 0;
+    }
+    // room at the end of the String
+    uint8_t *reserveWrite(size_t size) {
+      if (!target.reserve(target.length() + size) || !target.unshare()) return NULL;
+      return (uint8_t *)target.buffer + target.length();
+    }
+    size_t commitWrite(size_t size) {
+      target.len += size;
+      target.buffer[target.len] = 0;
+      target.modified();
+      return size;
+    }
+};
+
+// Writes to a FILE* with fwrite()
+class FilePrint : public BasicPrint<FilePrint>
+{
+  private:
+    FILE *output;
+    int write_error;
+
+  public:
+#ifdef stdout
+    explicit FilePrint(FILE *f = stdout) : output(f), write_error(0) {}
+#else
+    explicit FilePrint(FILE *f) : output(f), write_error(0) {}
+#endif
+
+    int getWriteError() { return write_error; }
+    void clearWriteError() { write_error = 0; }
+    int flush() { return fflush(output); }
+
+    using BasicPrint<FilePrint>::write;
+    size_t write(const uint8_t *buffer, size_t size) {
+      size_t n = fwrite(buffer, 1, size, output);
+      if (n < size) write_error = 1;
+      return n;
+    }
+};
+
+#endif
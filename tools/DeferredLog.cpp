@@ -0,0 +1,400 @@
+/*
+  DeferredLog.cpp - Deferred formatting: per-thread record buffers, the
+  drain, the background thread and the binary encoder and decoder.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "DeferredLog.h"
+
+// Thread buffers ////////////////////////////////////////////////////////////
+
+// Records are [size, payload size, format][payload] rounded to 16 bytes.
+// A record that would cross the end of the buffer is preceded by a
+// padding record (format NULL) up to the end.
+struct DeferredRecord
+{
+  uint32_t size;
+  uint32_t payload;
+  const DeferredFormat *format;
+};
+
+static const size_t record_header = (sizeof(DeferredRecord) + 15) & ~(size_t)15;
+
+// Single producer (its thread), single consumer (drain()).  Buffers are
+// never freed: when their thread ends they are drained and reused.
+struct DeferredBuffer
+{
+  uint8_t *data;
+  size_t size;                          // power of two
+  std::atomic<size_t> head;             // written by the producer
+  std::atomic<size_t> tail;             // written by drain()
+  std::atomic<unsigned long> dropped;
+  std::atomic<bool> orphaned;           // its thread ended
+  size_t reserved;                      // head after the pending record
+  DeferredBuffer *next;
+};
+
+static std::atomic<DeferredBuffer *> buffers(NULL);
+static std::atomic<size_t> buffer_size(DEFERREDLOG_BUFFER_SIZE);
+static std::mutex buffers_lock;
+static std::mutex drain_lock;
+
+static thread_local DeferredBuffer *thread_buffer = NULL;
+
+// gives the buffer back when the thread ends; a separate thread_local
+// so thread_buffer stays a plain pointer on the fast path
+struct DeferredThreadExit
+{
+  ~DeferredThreadExit() {
+    if (thread_buffer) thread_buffer->orphaned.store(true, std::memory_order_release);
+  }
+};
+
+static DeferredBuffer *acquireBuffer() {
+  static thread_local DeferredThreadExit thread_exit;
+  (void)thread_exit;
+  std::lock_guard<std::mutex> lock(buffers_lock);
+  // reuse the buffer of an ended thread once drained
+  for (DeferredBuffer *b = buffers.load(std::memory_order_relaxed); b; b = b->next) {
+    if (b->orphaned.load(std::memory_order_acquire) &&
+        b->head.load(std::memory_order_relaxed) == b->tail.load(std::memory_order_acquire)) {
+      b->orphaned.store(false, std::memory_order_relaxed);
+      return b;
+    }
+  }
+  size_t size = 256;
+  while (size < buffer_size.load(std::memory_order_relaxed)) size <<= 1;
+  DeferredBuffer *b = new DeferredBuffer;
+  b->data = (uint8_t *)malloc(size);
+  if (!b->data) {
+    delete b;
+    return NULL;
+  }
+  b->size = size;
+  b->head.store(0, std::memory_order_relaxed);
+  b->tail.store(0, std::memory_order_relaxed);
+  b->dropped.store(0, std::memory_order_relaxed);
+  b->orphaned.store(false, std::memory_order_relaxed);
+  b->reserved = 0;
+  b->next = buffers.load(std::memory_order_relaxed);
+  buffers.store(b, std::memory_order_release);
+  return b;
+}
+
+static void putRecord(uint8_t *at, size_t size, size_t payload, const DeferredFormat *format) {
+  DeferredRecord r;
+  r.size = (uint32_t)size;
+  r.payload = (uint32_t)payload;
+  r.format = format;
+  memcpy(at, &r, sizeof(r));
+}
+
+uint8_t *DeferredLog::begin(const DeferredFormat &format, size_t payload) {
+  DeferredBuffer *b = thread_buffer;
+  if (!b) {
+    b = thread_buffer = acquireBuffer();
+    if (!b) return NULL;
+  }
+  size_t need = (record_header + payload + 15) & ~(size_t)15;
+  size_t head = b->head.load(std::memory_order_relaxed);
+  size_t tail = b->tail.load(std::memory_order_acquire);
+  size_t offset = head & (b->size - 1);
+  size_t to_end = b->size - offset;
+  size_t pad = need > to_end ? to_end : 0;
+  if (need > b->size || head + pad + need - tail > b->size) {
+    b->dropped.fetch_add(1, std::memory_order_relaxed);
+    return NULL;
+  }
+  if (pad) {
+    putRecord(b->data + offset, pad, 0, NULL);
+    head += pad;
+    offset = 0;
+  }
+  putRecord(b->data + offset, need, payload, &format);
+  b->reserved = head + need;
+  return b->data + offset + record_header;
+}
+
+void DeferredLog::commit() {
+  DeferredBuffer *b = thread_buffer;
+  b->head.store(b->reserved, std::memory_order_release);
+}
+
+void DeferredLog::setBufferSize(size_t size) {
+  buffer_size.store(size, std::memory_order_relaxed);
+}
+
+unsigned long DeferredLog::dropped() {
+  unsigned long n = 0;
+  for (DeferredBuffer *b = buffers.load(std::memory_order_acquire); b; b = b->next) {
+    n += b->dropped.load(std::memory_order_relaxed);
+  }
+  return n;
+}
+
+size_t DeferredLog::drain(DeferredSink &sink) {
+  std::lock_guard<std::mutex> lock(drain_lock);
+  size_t records = 0;
+  for (DeferredBuffer *b = buffers.load(std::memory_order_acquire); b; b = b->next) {
+    size_t tail = b->tail.load(std::memory_order_relaxed);
+    size_t head = b->head.load(std::memory_order_acquire);
+    while (tail < head) {
+      DeferredRecord r;
+      const uint8_t *at = b->data + (tail & (b->size - 1));
+      memcpy(&r, at, sizeof(r));
+      if (r.format) {
+        sink.record(*r.format, at + record_header, r.payload);
+        records++;
+      }
+      tail += r.size;
+    }
+    b->tail.store(tail, std::memory_order_release);
+  }
+  return records;
+}
+
+// Background thread ///////////////////////////////////////////////////////////
+
+static std::mutex worker_lock;
+static std::condition_variable worker_wake;
+static std::thread *worker = NULL;
+static bool worker_stop = false;
+
+static void workerLoop(DeferredSink *sink, unsigned intervalMs) {
+  std::unique_lock<std::mutex> lock(worker_lock);
+  while (!worker_stop) {
+    lock.unlock();
+    DeferredLog::drain(*sink);
+    lock.lock();
+    worker_wake.wait_for(lock, std::chrono::milliseconds(intervalMs));
+  }
+  lock.unlock();
+  DeferredLog::drain(*sink);
+}
+
+bool DeferredLog::start(DeferredSink &sink, unsigned intervalMs) {
+  stop();
+  std::lock_guard<std::mutex> lock(worker_lock);
+  worker_stop = false;
+  worker = new std::thread(workerLoop, &sink, intervalMs);
+  return true;
+}
+
+void DeferredLog::stop() {
+  std::thread *running;
+  {
+    std::lock_guard<std::mutex> lock(worker_lock);
+    running = worker;
+    worker = NULL;
+    worker_stop = true;
+  }
+  if (!running) return;
+  worker_wake.notify_all();
+  running->join();
+  delete running;
+}
+
+// Text ////////////////////////////////////////////////////////////////////////
+
+void DeferredText::record(const DeferredFormat &format, const uint8_t *payload, size_t size) {
+  DeferredDecoder::print(output, format.tags, format.count, format.newline != 0, payload, size);
+}
+
+// Binary stream ///////////////////////////////////////////////////////////////
+//
+//   header  "DLOG", version, 3 zero bytes, uint32 1 (byte order)
+//   'F'     uint32 id, uint8 newline, uint8 count, count tags
+//   'R'     uint32 id, uint32 size, size bytes of payload
+//
+// Numbers in the byte order of the recording machine.
+
+static const uint8_t binary_magic[4] = {'D', 'L', 'O', 'G'};
+static const uint8_t binary_version = 1;
+static const size_t binary_header = 12;
+
+static void append(std::vector<uint8_t> &v, const void *data, size_t n) {
+  v.insert(v.end(), (const uint8_t *)data, (const uint8_t *)data + n);
+}
+
+static void append32(std::vector<uint8_t> &v, uint32_t n) {
+  append(v, &n, 4);
+}
+
+void DeferredBinary::record(const DeferredFormat &format, const uint8_t *payload, size_t size) {
+  buffer.clear();
+  if (!started) {
+    append(buffer, binary_magic, 4);
+    buffer.push_back(binary_version);
+    buffer.insert(buffer.end(), 3, 0);
+    append32(buffer, 1);
+    started = true;
+  }
+  std::unordered_map<const DeferredFormat *, uint32_t>::iterator it = ids.find(&format);
+  uint32_t id;
+  if (it == ids.end()) {
+    id = (uint32_t)ids.size();
+    ids[&format] = id;
+    buffer.push_back('F');
+    append32(buffer, id);
+    buffer.push_back(format.newline);
+    buffer.push_back(format.count);
+    append(buffer, format.tags, format.count);
+  } else {
+    id = it->second;
+  }
+  buffer.push_back('R');
+  append32(buffer, id);
+  append32(buffer, (uint32_t)size);
+  append(buffer, payload, size);
+  output.write(buffer.data(), buffer.size());
+}
+
+static uint32_t read32(const uint8_t *p) {
+  uint32_t n;
+  memcpy(&n, p, 4);
+  return n;
+}
+
+size_t DeferredDecoder::decode(const uint8_t *data, size_t size) {
+  size_t used = 0;
+  if (failed) return size;
+  if (!started) {
+    if (size < binary_header) return 0;
+    if (memcmp(data, binary_magic, 4) != 0 || data[4] != binary_version || read32(data + 8) != 1) {
+      failed = true;
+      return size;
+    }
+    started = true;
+    used = binary_header;
+  }
+  while (used < size) {
+    const uint8_t *p = data + used;
+    size_t left = size - used;
+    if (p[0] == 'F') {
+      if (left < 7 || left < 7 + (size_t)p[6]) break;
+      uint32_t id = read32(p + 1);
+      // DeferredBinary numbers the descriptors in order: a jump ahead is
+      // corruption, not a size to allocate
+      if (id > formats.size()) {
+        failed = true;
+        return size;
+      }
+      if (id == formats.size()) formats.resize((size_t)id + 1);
+      formats[id] = std::make_pair(p[5] != 0, std::string((const char *)p + 7, p[6]));
+      used += 7 + (size_t)p[6];
+    } else if (p[0] == 'R') {
+      if (left < 9) break;
+      uint32_t id = read32(p + 1);
+      size_t length = read32(p + 5);
+      if (left - 9 < length) break;
+      if (id >= formats.size() ||
+          !print(output, (const uint8_t *)formats[id].second.data(), formats[id].second.size(),
+                 formats[id].first, p + 9, length)) {
+        failed = true;
+        return size;
+      }
+      used += 9 + length;
+    } else {
+      failed = true;
+      return size;
+    }
+  }
+  return used;
+}
+
+bool DeferredDecoder::print(Print &output, const uint8_t *tags, size_t count, bool newline,
+                            const uint8_t *payload, size_t size) {
+  const uint8_t *p = payload;
+  const uint8_t *end = payload + size;
+  for (size_t i = 0; i < count; i++) {
+    uint8_t tag = (uint8_t)(tags[i] & (DEFERRED_FORMATTED - 1));
+    bool formatted = (tags[i] & DEFERRED_FORMATTED) != 0;
+    size_t width;
+    switch (tag) {
+      case DEFERRED_CHAR: case DEFERRED_UCHAR: width = 1; break;
+      case DEFERRED_INT: case DEFERRED_UINT: case DEFERRED_TEXT: width = 4; break;
+      case DEFERRED_LONG: case DEFERRED_ULONG: case DEFERRED_DOUBLE: width = 8; break;
+      default: return false;
+    }
+    if ((size_t)(end - p) < width + (formatted ? 4 : 0)) return false;
+    const uint8_t *value = p;
+    p += width;
+    if (tag == DEFERRED_TEXT) {
+      size_t length = read32(value);
+      if ((size_t)(end - p) < length + (formatted ? 4 : 0)) return false;
+      value = p;
+      p += length;
+      output.print(StringView((const char *)value, length));
+      continue;
+    }
+    int format = tag == DEFERRED_DOUBLE ? 2 : DEC;
+    if (formatted) {
+      int32_t f;
+      memcpy(&f, p, 4);
+      p += 4;
+      format = f;
+    }
+    switch (tag) {
+      case DEFERRED_CHAR:
+        output.print((char)value[0]);
+        break;
+      case DEFERRED_UCHAR:
+        output.print((unsigned char)value[0], format);
+        break;
+      case DEFERRED_INT: {
+        int32_t n;
+        memcpy(&n, value, 4);
+        output.print((int)n, format);
+        break;
+      }
+      case DEFERRED_UINT: {
+        uint32_t n;
+        memcpy(&n, value, 4);
+        output.print((unsigned int)n, format);
+        break;
+      }
+      case DEFERRED_LONG: {
+        int64_t n;
+        memcpy(&n, value, 8);
+        output.print((long)n, format);
+        break;
+      }
+      case DEFERRED_ULONG: {
+        uint64_t n;
+        memcpy(&n, value, 8);
+        output.print((unsigned long)n, format);
+        break;
+      }
+      case DEFERRED_DOUBLE: {
+        double n;
+        memcpy(&n, value, 8);
+        output.print(n, format);
+        break;
+      }
+    }
+  }
+  if (newline) output.println();
+  return p == end;
+}
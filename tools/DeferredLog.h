@@ -0,0 +1,294 @@
+/*
+  DeferredLog.h - Deferred formatting: print() and println() arguments
+  are recorded as raw bytes in a buffer of the calling thread, with a
+  pointer to a static descriptor of their types, and formatted later by
+  a background thread, or offline from a binary file by the
+  deferred_decode tool.  The text is exactly what Print would have
+  written.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef DeferredLog_h
+#define DeferredLog_h
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <utility>
+
+#include "Print.h"
+
+// Bytes of the buffer of each thread, a power of two.  A record that
+// doesn't fit in the free space is dropped and counted.
+#ifndef DEFERREDLOG_BUFFER_SIZE
+#define DEFERREDLOG_BUFFER_SIZE (64 * 1024)
+#endif
+
+// Usage, on the latency critical thread:
+//
+//     DeferredLog::println("order ", id, " filled at ", price);
+//     DeferredLog::println("flags ", DeferredLog::number(flags, HEX));
+//
+// and on another thread, or with DeferredLog::start():
+//
+//     DeferredText text(Serial);
+//     DeferredLog::drain(text);
+//
+// The arguments are the types Print::print() takes, but Printable:
+// chars, integers, doubles, char arrays, String and StringView (strings
+// are copied).  DeferredLog::number() adds the base or the digits
+// argument of print().  Lines of one thread keep their order; lines of
+// different threads are only ordered within each drain() call by thread.
+
+// Argument types, in the descriptors and in the binary files
+enum DeferredTag
+{
+  DEFERRED_CHAR = 1,      // print(char)
+  DEFERRED_UCHAR,         // print(unsigned char, base)
+  DEFERRED_INT,           // print(int, base)
+  DEFERRED_UINT,          // print(unsigned int, base)
+  DEFERRED_LONG,          // print(long, base), 64 bits recorded
+  DEFERRED_ULONG,         // print(unsigned long, base), 64 bits recorded
+  DEFERRED_DOUBLE,        // print(double, digits)
+  DEFERRED_TEXT,          // print() of a string, 32 bits length and bytes
+  // flag: an int32 base or digits argument follows the value
+  DEFERRED_FORMATTED = 0x40
+};
+
+// Static descriptor of the arguments of one print()/println() signature
+struct DeferredFormat
+{
+  uint8_t newline;
+  uint8_t count;
+  const uint8_t *tags;
+};
+
+// Encoders, picked by the same overload resolution as Print::print()
+struct DeferredChar
+{
+  typedef char type;
+  static const uint8_t tag = DEFERRED_CHAR;
+  static size_t size(type) { return 1; }
+  static uint8_t *put(uint8_t *p, type v) { *p = (uint8_t)v; return p + 1; }
+};
+
+template <class T, class Stored, uint8_t Tag>
+struct DeferredValue
+{
+  typedef T type;
+  static const uint8_t tag = Tag;
+  static size_t size(type) { return sizeof(Stored); }
+  static uint8_t *put(uint8_t *p, type v) {
+    Stored s = (Stored)v;
+    memcpy(p, &s, sizeof(s));
+    return p + sizeof(s);
+  }
+};
+
+typedef DeferredValue<unsigned char, uint8_t, DEFERRED_UCHAR> DeferredUChar;
+typedef DeferredValue<int, int32_t, DEFERRED_INT> DeferredInt;
+typedef DeferredValue<unsigned int, uint32_t, DEFERRED_UINT> DeferredUInt;
+typedef DeferredValue<long, int64_t, DEFERRED_LONG> DeferredLong;
+typedef DeferredValue<unsigned long, uint64_t, DEFERRED_ULONG> DeferredULong;
+typedef DeferredValue<double, double, DEFERRED_DOUBLE> DeferredDouble;
+
+struct DeferredString
+{
+  static const uint8_t tag = DEFERRED_TEXT;
+  static size_t size(const char *s) { return 4 + (s ? strlen(s) : 0); }
+  static size_t size(const String &s) { return 4 + (s.c_str() ? s.length() : 0); }
+  static size_t size(const StringView &v) { return 4 + v.length(); }
+  static uint8_t *put(uint8_t *p, const char *s) { return put(p, s, s ? strlen(s) : 0); }
+  static uint8_t *put(uint8_t *p, const String &s) { return put(p, s.c_str(), s.c_str() ? s.length() : 0); }
+  static uint8_t *put(uint8_t *p, const StringView &v) { return put(p, v.data(), v.length()); }
+  static uint8_t *put(uint8_t *p, const char *s, size_t n) {
+    uint32_t len = (uint32_t)n;
+    memcpy(p, &len, 4);
+    if (n) memcpy(p + 4, s, n);
+    return p + 4 + n;
+  }
+};
+
+// A number with the second argument of print(), see DeferredLog::number()
+template <class Kind>
+struct DeferredNumber
+{
+  typename Kind::type value;
+  int format;
+
+  static const uint8_t tag = Kind::tag | DEFERRED_FORMATTED;
+  static size_t size(const DeferredNumber &n) { return Kind::size(n.value) + 4; }
+  static uint8_t *put(uint8_t *p, const DeferredNumber &n) {
+    p = Kind::put(p, n.value);
+    int32_t f = (int32_t)n.format;
+    memcpy(p, &f, 4);
+    return p + 4;
+  }
+};
+
+// Overload sets of Print::print(x) and Print::print(x, int), declared
+// only, for decltype()
+struct DeferredKinds
+{
+  static DeferredString of(const String &);
+  static DeferredString of(const StringView &);
+  static DeferredString of(const char[]);
+  static DeferredChar of(char);
+  static DeferredUChar of(unsigned char);
+  static DeferredInt of(int);
+  static DeferredUInt of(unsigned int);
+  static DeferredLong of(long);
+  static DeferredULong of(unsigned long);
+  static DeferredDouble of(double);
+  template <class Kind>
+  static DeferredNumber<Kind> of(const DeferredNumber<Kind> &);
+
+  static DeferredUChar withFormat(unsigned char);
+  static DeferredInt withFormat(int);
+  static DeferredUInt withFormat(unsigned int);
+  static DeferredLong withFormat(long);
+  static DeferredULong withFormat(unsigned long);
+  static DeferredDouble withFormat(double);
+};
+
+template <bool Newline, class... Kinds>
+struct DeferredSignature
+{
+  static const uint8_t tags[sizeof...(Kinds) + 1];
+  static const DeferredFormat format;
+};
+
+template <bool Newline, class... Kinds>
+const uint8_t DeferredSignature<Newline, Kinds...>::tags[sizeof...(Kinds) + 1] = {Kinds::tag..., 0};
+
+template <bool Newline, class... Kinds>
+const DeferredFormat DeferredSignature<Newline, Kinds...>::format = {Newline, (uint8_t)sizeof...(Kinds), tags};
+
+// Where drain() sends the records
+class DeferredSink
+{
+  public:
+    virtual ~DeferredSink() {}
+    // one record: the arguments of a print()/println(), encoded
+    virtual void record(const DeferredFormat &format, const uint8_t *payload, size_t size) = 0;
+};
+
+class DeferredLog
+{
+  public:
+    template <class... A>
+    static bool print(const A &... args) { return record<false>(args...); }
+    template <class... A>
+    static bool println(const A &... args) { return record<true>(args...); }
+
+    // x printed with base (integers) or digits (doubles), as print(x, format)
+    template <class T>
+    static DeferredNumber<decltype(DeferredKinds::withFormat(std::declval<T>()))> number(T x, int format) {
+      DeferredNumber<decltype(DeferredKinds::withFormat(std::declval<T>()))> n = {x, format};
+      return n;
+    }
+
+    // size of the buffers of the threads that record for the first time
+    static void setBufferSize(size_t size);
+    // records dropped because a buffer was full
+    static unsigned long dropped();
+
+    // sends the records of every thread to sink, returns how many.  One
+    // drain() at a time, it may run alongside print() and println().
+    static size_t drain(DeferredSink &sink);
+
+    // drains to sink every intervalMs milliseconds on a background
+    // thread, until stop(), which drains one last time
+    static bool start(DeferredSink &sink, unsigned intervalMs = 10);
+    static void stop();
+
+  private:
+    template <bool Newline, class... A>
+    static bool record(const A &... args) {
+      static_assert(sizeof...(A) < 256, "too many arguments");
+      typedef DeferredSignature<Newline, decltype(DeferredKinds::of(args))...> Signature;
+      size_t size = 0;
+      int sizes[] = {0, (size += decltype(DeferredKinds::of(args))::size(args), 0)...};
+      uint8_t *p = begin(Signature::format, size);
+      if (!p) return false;
+      int puts[] = {0, (p = decltype(DeferredKinds::of(args))::put(p, args), 0)...};
+      (void)sizes;
+      (void)puts;
+      commit();
+      return true;
+    }
+
+    // room for a record of size bytes in the buffer of the thread, NULL
+    // if full; commit() publishes it
+    static uint8_t *begin(const DeferredFormat &format, size_t size);
+    static void commit();
+};
+
+// Formats the records with Print::print(), as the recording thread
+// would have
+class DeferredText : public DeferredSink
+{
+  public:
+    explicit DeferredText(Print &_output) : output(_output) {}
+    void record(const DeferredFormat &format, const uint8_t *payload, size_t size);
+
+  private:
+    Print &output;
+};
+
+// Writes the records to a binary stream for deferred_decode: a header,
+// each descriptor once, then the raw records.  Each record is one write().
+class DeferredBinary : public DeferredSink
+{
+  public:
+    explicit DeferredBinary(Print &_output) : output(_output), started(false) {}
+    void record(const DeferredFormat &format, const uint8_t *payload, size_t size);
+
+  private:
+    Print &output;
+    bool started;
+    std::unordered_map<const DeferredFormat *, uint32_t> ids;
+    std::vector<uint8_t> buffer;
+};
+
+// Reads the binary stream of DeferredBinary and prints it
+class DeferredDecoder
+{
+  public:
+    explicit DeferredDecoder(Print &_output) : output(_output), started(false), failed(false) {}
+
+    // decodes the complete records at the start of data, returns the
+    // bytes used: the rest must be passed again with more data
+    size_t decode(const uint8_t *data, size_t size);
+    // false once the stream is found corrupt
+    bool ok() const { return !failed; }
+
+    // prints one record as Print::print() would, false if malformed
+    static bool print(Print &output, const uint8_t *tags, size_t count, bool newline,
+                      const uint8_t *payload, size_t size);
+
+  private:
+    Print &output;
+    bool started;
+    bool failed;
+    std::vector<std::pair<bool, std::string> > formats;   // newline, tags
+};
+
+#endif
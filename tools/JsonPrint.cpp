@@ -0,0 +1,286 @@
+/*
+  JsonPrint.cpp - JSON writer on top of any Print: objects, arrays, keys
+  and values, each record assembled in one buffer and written at once.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "JsonPrint.h"
+#include "StringKernels.h"
+
+// Escapes what a Printable prints into the record
+class JsonPrint::EscapePrint : public Print
+{
+  private:
+    JsonPrint &json;
+
+  public:
+    explicit EscapePrint(JsonPrint &j) : json(j) {}
+
+    using Print::write;
+    size_t write(uint8_t c) { json.appendEscaped((const char *)&c, 1); return 1; }
+    size_t write(const uint8_t *buffer, size_t size) {
+      json.appendEscaped((const char *)buffer, size);
+      return size;
+    }
+};
+
+JsonPrint::JsonPrint(Print &_output, bool _lines)
+  : output(_output), lines(_lines), write_error(0), buf(NULL), len(0), cap(0), last_size(0),
+    broken(false), depth(0), after_key(false)
+{
+}
+
+JsonPrint::~JsonPrint()
+{
+  free(buf);
+}
+
+// Record buffer ///////////////////////////////////////////////////////////////
+
+bool JsonPrint::reserve(size_t extra)
+{
+  if (PrintFormat::growBuffer(buf, cap, len + extra)) return true;
+  write_error = 1;
+  broken = true;
+  return false;
+}
+
+void JsonPrint::append(const char *s, size_t n)
+{
+  if (!reserve(n)) return;
+  memcpy(buf + len, s, n);
+  len += n;
+}
+
+void JsonPrint::appendEscaped(const char *s, size_t n)
+{
+  static const char hex[] = "0123456789abcdef";
+  while (n > 0) {
+    // clean runs are copied at once
+    size_t run = StringKernels::spanJsonPlain(s, n);
+    append(s, run);
+    s += run;
+    n -= run;
+    if (n == 0) break;
+
+    char esc[6] = {'\\', 0, '0', '0', 0, 0};
+    size_t size = 2;
+    switch (*s) {
+      case '"': esc[1] = '"'; break;
+      case '\\': esc[1] = '\\'; break;
+      case '\n': esc[1] = 'n'; break;
+      case '\r': esc[1] = 'r'; break;
+      case '\t': esc[1] = 't'; break;
+      case '\b': esc[1] = 'b'; break;
+      case '\f': esc[1] = 'f'; break;
+      default:
+        esc[1] = 'u';
+        esc[4] = hex[(unsigned char)*s >> 4];
+        esc[5] = hex[*s & 0x0F];
+        size = 6;
+    }
+    append(esc, size);
+    s++;
+    n--;
+  }
+}
+
+// Structure ///////////////////////////////////////////////////////////////////
+
+JsonPrint &JsonPrint::misuse()
+{
+  write_error = JSON_PRINT_MISUSE;
+  return *this;
+}
+
+// adds the comma before a value, false if no value is allowed here
+bool JsonPrint::beginValue()
+{
+  if (depth > 0 && !after_key) {
+    if (stack[depth - 1] == '{') return false;
+    if (has_items[depth - 1]) append(",", 1);
+    has_items[depth - 1] = true;
+  }
+  after_key = false;
+  return true;
+}
+
+// writes the record when the top level value is complete
+void JsonPrint::endValue()
+{
+  if (depth > 0) return;
+  if (lines) append("\n", 1);
+  if (broken) {
+    // the record is incomplete, don't write it
+    broken = false;
+    len = 0;
+    return;
+  }
+  size_t n = output.write((const uint8_t *)buf, len);
+  if (n < len) write_error = 1;
+  last_size = len;
+  len = 0;
+}
+
+void JsonPrint::discard()
+{
+  broken = false;
+  len = 0;
+  depth = 0;
+  after_key = false;
+}
+
+JsonPrint &JsonPrint::beginObject()
+{
+  if (depth == JSON_PRINT_DEPTH || !beginValue()) return misuse();
+  append("{", 1);
+  stack[depth] = '{';
+  has_items[depth] = false;
+  depth++;
+  return *this;
+}
+
+JsonPrint &JsonPrint::endObject()
+{
+  if (depth == 0 || stack[depth - 1] != '{' || after_key) return misuse();
+  append("}", 1);
+  depth--;
+  endValue();
+  return *this;
+}
+
+JsonPrint &JsonPrint::beginArray()
+{
+  if (depth == JSON_PRINT_DEPTH || !beginValue()) return misuse();
+  append("[", 1);
+  stack[depth] = '[';
+  has_items[depth] = false;
+  depth++;
+  return *this;
+}
+
+JsonPrint &JsonPrint::endArray()
+{
+  if (depth == 0 || stack[depth - 1] != '[') return misuse();
+  append("]", 1);
+  depth--;
+  endValue();
+  return *this;
+}
+
+JsonPrint &JsonPrint::key(const char *name)
+{
+  return key(StringView(name ? name : ""));
+}
+
+JsonPrint &JsonPrint::key(const StringView &name)
+{
+  if (depth == 0 || stack[depth - 1] != '{' || after_key) return misuse();
+  if (!reserve(name.length() + 4)) return *this;
+  if (has_items[depth - 1]) append(",", 1);
+  has_items[depth - 1] = true;
+  append("\"", 1);
+  appendEscaped(name.data(), name.length());
+  append("\":", 2);
+  after_key = true;
+  return *this;
+}
+
+// Values //////////////////////////////////////////////////////////////////////
+
+JsonPrint &JsonPrint::value(const StringView &str)
+{
+  if (!beginValue()) return misuse();
+  if (!reserve(str.length() + 3)) return *this;
+  append("\"", 1);
+  appendEscaped(str.data(), str.length());
+  append("\"", 1);
+  endValue();
+  return *this;
+}
+
+JsonPrint &JsonPrint::value(const char *str)
+{
+  if (!str) return nullValue();
+  return value(StringView(str));
+}
+
+JsonPrint &JsonPrint::value(const String &str)
+{
+  // an invalid String has no contents at all
+  if (!str.c_str()) return nullValue();
+  return value(str.view());
+}
+
+JsonPrint &JsonPrint::value(const Printable &x)
+{
+  if (!beginValue()) return misuse();
+  append("\"", 1);
+  EscapePrint escape(*this);
+  x.printTo(escape);
+  append("\"", 1);
+  endValue();
+  return *this;
+}
+
+JsonPrint &JsonPrint::value(unsigned long n)
+{
+  char number[PrintFormat::NUMBER_SIZE];
+  char *end = number + sizeof(number);
+  char *str = PrintFormat::formatNumber(end, n, DEC);
+  return rawValue(StringView(str, (size_t)(end - str)));
+}
+
+JsonPrint &JsonPrint::value(long n)
+{
+  if (n >= 0) return value((unsigned long)n);
+  char number[PrintFormat::NUMBER_SIZE];
+  char *end = number + sizeof(number);
+  char *str = PrintFormat::formatNumber(end, 0UL - (unsigned long)n, DEC);
+  *--str = '-';
+  return rawValue(StringView(str, (size_t)(end - str)));
+}
+
+JsonPrint &JsonPrint::value(double n, int digits)
+{
+  if (isnan(n) || isinf(n)) return nullValue();
+  char number[64];
+  return rawValue(StringView(number, PrintFormat::formatDouble(number, n, digits)));
+}
+
+JsonPrint &JsonPrint::value(bool b)
+{
+  return b ? rawValue(StringView("true", 4)) : rawValue(StringView("false", 5));
+}
+
+JsonPrint &JsonPrint::nullValue()
+{
+  return rawValue(StringView("null", 4));
+}
+
+JsonPrint &JsonPrint::rawValue(const StringView &json)
+{
+  if (!beginValue()) return misuse();
+  append(json.data(), json.length());
+  endValue();
+  return *this;
+}
@@ -0,0 +1,132 @@
+/*
+  JsonPrint.h - JSON writer on top of any Print: objects, arrays, keys
+  and values, each record assembled in one buffer and written at once.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef JsonPrint_h
+#define JsonPrint_h
+
+#include "Print.h"
+
+// maximum nesting of objects and arrays
+#ifndef JSON_PRINT_DEPTH
+#define JSON_PRINT_DEPTH 32
+#endif
+
+// Writes JSON values to a Print, one record (a complete top level value)
+// per write() call, by default one record per line (JSON Lines):
+//
+//     JsonPrint json(Serial);
+//     json.beginObject();
+//     json.key("name").value(name);
+//     json.key("values").beginArray();
+//     for (int i = 0; i < count; i++) json.value(values[i]);
+//     json.endArray();
+//     json.endObject();          // the record is written here
+//
+// Commas and colons are added as needed.  Strings are escaped, bytes
+// from 0x80 are copied as they are, so String contents should be UTF-8.
+// Doubles that are not finite are written as null.
+//
+// Misuse, like a value without key in an object or an endArray() that
+// closes an object, is ignored and sets getWriteError() to
+// JSON_PRINT_MISUSE; a failed write or allocation sets it to 1.
+class JsonPrint
+{
+  public:
+    enum { JSON_PRINT_MISUSE = 2 };
+
+    explicit JsonPrint(Print &output, bool lines = true);
+    ~JsonPrint();
+
+    int getWriteError() { return write_error; }
+    void clearWriteError() { write_error = 0; }
+
+    JsonPrint &beginObject();
+    JsonPrint &endObject();
+    JsonPrint &beginArray();
+    JsonPrint &endArray();
+
+    // name of the next value of an object
+    JsonPrint &key(const char *name);
+    JsonPrint &key(const String &name) { return key(name.view()); }
+    JsonPrint &key(const StringView &name);
+
+    // strings
+    JsonPrint &value(const char *str);
+    JsonPrint &value(const String &str);
+    JsonPrint &value(const StringView &str);
+    JsonPrint &value(char c) { return value(StringView(&c, 1)); }
+    // printed form of a Printable, as a string
+    JsonPrint &value(const Printable &x);
+
+    // numbers, booleans and null
+    JsonPrint &value(unsigned char n) { return value((unsigned long)n); }
+    JsonPrint &value(int n) { return value((long)n); }
+    JsonPrint &value(unsigned int n) { return value((unsigned long)n); }
+    JsonPrint &value(long n);
+    JsonPrint &value(unsigned long n);
+    JsonPrint &value(double n, int digits = 2);
+    JsonPrint &value(bool b);
+    JsonPrint &nullValue();
+    // already formatted JSON, copied as it is
+    JsonPrint &rawValue(const StringView &json);
+
+    // key and value at once
+    template <class T>
+    JsonPrint &field(const char *name, const T &v) { return key(name).value(v); }
+    JsonPrint &field(const char *name, double v, int digits) { return key(name).value(v, digits); }
+
+    // drops the record being built, for example after an error
+    void discard();
+    // bytes of the last record written
+    size_t lastRecordSize() const { return last_size; }
+
+  private:
+    Print &output;
+    bool lines;
+    int write_error;
+
+    // record buffer, kept between records
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t last_size;
+    bool broken;       // an allocation failed, the record is incomplete
+
+    // open containers: '{' or '[', and whether they have items yet
+    char stack[JSON_PRINT_DEPTH];
+    bool has_items[JSON_PRINT_DEPTH];
+    int depth;
+    bool after_key;
+
+    class EscapePrint;
+
+    bool reserve(size_t extra);
+    void append(const char *s, size_t n);
+    void appendEscaped(const char *s, size_t n);
+    bool beginValue();
+    void endValue();
+    JsonPrint &misuse();
+
+    JsonPrint(const JsonPrint &);
+    JsonPrint &operator = (const JsonPrint &);
+};
+
+#endif
@@ -0,0 +1,182 @@
+/*
+  Log.cpp - Leveled logging on top of Print: levels below the compile time
+  level are removed, the runtime level is checked before the arguments
+  are evaluated, and per-module levels are cached at each module.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+
+#include "Log.h"
+
+// modules with a level of their own
+#ifndef LOG_MODULE_LEVELS
+#define LOG_MODULE_LEVELS 32
+#endif
+
+// Writes to "stderr", the default output
+class StderrPrint : public Print
+{
+  public:
+    using Print::write;
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stderr); }
+};
+
+struct ModuleLevel
+{
+  String module;
+  int level;
+};
+
+// the modules start with generation 0, so they resolve their level on
+// first use
+std::atomic<unsigned int> Log::generation(1);
+
+static std::atomic<int> default_level(LOG_LEVEL_INFO);
+// module_levels, never held while writing, so resolving a level (even
+// for a line that ends up filtered) doesn't wait for a slow output
+static std::mutex levels_lock;
+// output, held only for the single write() of a formatted line
+static std::mutex output_lock;
+static ModuleLevel module_levels[LOG_MODULE_LEVELS];
+static size_t module_level_count = 0;
+static StderrPrint stderr_print;
+static Print *output = &stderr_print;
+
+void Log::setLevel(int level)
+{
+  default_level.store(level, std::memory_order_relaxed);
+  generation.fetch_add(1, std::memory_order_acq_rel);
+}
+
+int Log::level()
+{
+  return default_level.load(std::memory_order_relaxed);
+}
+
+void Log::setModuleLevel(const char *module, int level)
+{
+  {
+    std::lock_guard<std::mutex> lock(levels_lock);
+    size_t i = 0;
+    while (i < module_level_count && module_levels[i].module != module) i++;
+    if (i == module_level_count) {
+      if (i == LOG_MODULE_LEVELS) return;
+      module_levels[i].module = module;
+      module_level_count++;
+    }
+    module_levels[i].level = level;
+  }
+  generation.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void Log::clearModuleLevel(const char *module)
+{
+  {
+    std::lock_guard<std::mutex> lock(levels_lock);
+    for (size_t i = 0; i < module_level_count; i++) {
+      if (module_levels[i].module == module) {
+        module_levels[i] = module_levels[--module_level_count];
+        module_levels[module_level_count].module = "";
+        break;
+      }
+    }
+  }
+  generation.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void Log::setOutput(Print &_output)
+{
+  // waits for the line being written to the previous output
+  std::lock_guard<std::mutex> lock(output_lock);
+  output = &_output;
+}
+
+const char *Log::levelName(int level)
+{
+  switch (level) {
+    case LOG_LEVEL_ERROR: return "ERROR";
+    case LOG_LEVEL_WARN: return "WARN";
+    case LOG_LEVEL_INFO: return "INFO";
+    case LOG_LEVEL_DEBUG: return "DEBUG";
+    case LOG_LEVEL_TRACE: return "TRACE";
+  }
+  return "NONE";
+}
+
+int Log::resolve(const char *module)
+{
+  std::lock_guard<std::mutex> lock(levels_lock);
+  for (size_t i = 0; i < module_level_count; i++) {
+    if (module_levels[i].module == module) return module_levels[i].level;
+  }
+  return default_level.load(std::memory_order_relaxed);
+}
+
+void Log::emit(const char *line, size_t size)
+{
+  // the line was formatted in the LogLine of the caller: the lock only
+  // covers one write, so lines of different threads don't mix
+  std::lock_guard<std::mutex> lock(output_lock);
+  output->write((const uint8_t *)line, size);
+}
+
+// Modules ///////////////////////////////////////////////////////////////////
+
+void LogModule::refresh(unsigned int current)
+{
+  cached_level.store(Log::resolve(name), std::memory_order_relaxed);
+  cached_generation.store(current, std::memory_order_release);
+}
+
+// Lines /////////////////////////////////////////////////////////////////////
+
+LogLine::LogLine(const LogModule &module, int level) : len(0), truncated(false)
+{
+  print(Log::levelName(level));
+  print(' ');
+  if (module.name[0]) {
+    print(module.name);
+    print(": ");
+  }
+}
+
+LogLine::~LogLine()
+{
+  // a cut message doesn't end with part of a UTF-8 character
+  if (truncated) len = StringKernels::utf8Boundary(line, len, len);
+  // room for the line end was kept by write()
+  line[len++] = '\r';
+  line[len++] = '\n';
+  Log::emit(line, len);
+}
+
+size_t LogLine::write(const uint8_t *buffer, size_t size)
+{
+  size_t room = sizeof(line) - 2 - len;
+  if (size > room) {
+    size = room;
+    truncated = true;
+  }
+  memcpy(line + len, buffer, size);
+  len += size;
+  return size;
+}
@@ -0,0 +1,185 @@
+/*
+  Log.h - Leveled logging on top of Print: levels below the compile time
+  level are removed, the runtime level is checked before the arguments
+  are evaluated, and per-module levels are cached at each module.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef Log_h
+#define Log_h
+
+#include <atomic>
+
+#include "Print.h"
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_LEVEL_TRACE 5
+
+// Most verbose level compiled in, the macros of the levels above it
+// expand to nothing at all
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_TRACE
+#endif
+
+// Longest line, longer messages are truncated (at a UTF-8 character
+// boundary)
+#ifndef LOG_LINE_SIZE
+#define LOG_LINE_SIZE 256
+#endif
+
+// Usage, in a .cpp file:
+//
+//     #define LOG_MODULE "net"        // optional, before the include
+//     #include "Log.h"
+//
+//     LOG_INFO("connected to ", host, " in ", ms, " ms");
+//     LOG_DEBUG("request: ", request.substring(0, 40));
+//
+// The arguments are anything Print::print() takes, and are only
+// evaluated when the level is enabled.  Each message is one line,
+// "LEVEL module: message", written with a single write().
+//
+// Every file including Log.h has its own LogModule, named LOG_MODULE
+// (or "" if not defined), that caches its runtime level.  Log.h is
+// meant for .cpp files, not for headers.
+
+class LogModule;
+
+class Log
+{
+  public:
+    // runtime level of the modules without a level of their own,
+    // LOG_LEVEL_INFO by default
+    static void setLevel(int level);
+    static int level();
+    // runtime level of one module, overriding setLevel()
+    static void setModuleLevel(const char *module, int level);
+    static void clearModuleLevel(const char *module);
+
+    // where lines go, "stderr" by default
+    static void setOutput(Print &output);
+
+    // name of a level, "INFO" for LOG_LEVEL_INFO
+    static const char *levelName(int level);
+
+    // changes every time a level changes, so the modules know when
+    // their cached level is stale
+    static std::atomic<unsigned int> generation;
+
+  private:
+    friend class LogModule;
+    friend class LogLine;
+    static int resolve(const char *module);
+    static void emit(const char *line, size_t size);
+};
+
+class LogModule
+{
+  public:
+    constexpr explicit LogModule(const char *_name) : name(_name), cached_level(0), cached_generation(0) {}
+
+    bool enabled(int level) {
+      unsigned int current = Log::generation.load(std::memory_order_acquire);
+      if (cached_generation.load(std::memory_order_acquire) != current) refresh(current);
+      return level <= cached_level.load(std::memory_order_relaxed);
+    }
+
+    const char *const name;
+
+  private:
+    std::atomic<int> cached_level;
+    std::atomic<unsigned int> cached_generation;
+
+    void refresh(unsigned int current);
+};
+
+// One line being formatted, written when destroyed
+class LogLine : public Print
+{
+  public:
+    LogLine(const LogModule &module, int level);
+    ~LogLine();
+
+    using Print::write;
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size);
+
+    void printAll() {}
+    template <class T, class... Rest>
+    void printAll(const T &first, const Rest &... rest) {
+      print(first);
+      printAll(rest...);
+    }
+
+  private:
+    char line[LOG_LINE_SIZE];
+    size_t len;
+    bool truncated;
+};
+
+#ifndef LOG_MODULE
+#define LOG_MODULE ""
+#endif
+
+static LogModule log_module(LOG_MODULE);
+
+#define LOG_AT(level, ...) \
+  do { \
+    if (log_module.enabled(level)) { \
+      LogLine log_line(log_module, level); \
+      log_line.printAll(__VA_ARGS__); \
+    } \
+  } while (0)
+
+#define LOG_NOTHING(...) do {} while (0)
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) LOG_NOTHING()
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) LOG_NOTHING()
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_NOTHING()
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_NOTHING()
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) LOG_NOTHING()
+#endif
+
+#endif
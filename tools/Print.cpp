@@ -50,11 +50,13 @@ size_t Print::write(const uint8_t *buffer, size_t size)
 
 size_t Print::print(const String &s)
 {
-  size_t n = 0;
-  for (uint16_t i = 0; i < s.length(); i++) {
-    n += write((uint8_t)s[i]);
-  }
-  return n;
+  if (!s.c_str()) return 0;
+  return write((const uint8_t *)s.c_str(), s.length());
+}
+
+size_t Print::print(const StringView &v)
+{
+  return write((const uint8_t *)v.data(), v.length());
 }
 
 size_t Print::print(const char str[])
@@ -89,8 +91,7 @@ size_t Print::print(long n, int base)
   } else if (base == 10) {
     if (n < 0) {
       size_t t = print('-');
-      n = -n;
-      return printNumber((unsigned long)n, 10) + t;
+      return printNumber(0UL - (unsigned long)n, 10) + t;
     }
     return printNumber((unsigned long)n, 10);
   } else {
@@ -111,6 +112,20 @@ size_t Print::print(double n, int digits)
 
 size_t Print::print(const Printable& x)
 {
+  size_t hint = x.printedSizeHint();
+  if (hint > 0) {
+    // render in one piece, into the sink buffer or on the stack
+    uint8_t *dst = reserveWrite(hint);
+    if (dst) {
+      size_t n = x.printToBuffer((char *)dst, hint);
+      if (n > 0) return commitWrite(n);
+      commitWrite(0);
+    } else if (hint <= PRINT_STACK_BUFFER_SIZE) {
+      char buf[PRINT_STACK_BUFFER_SIZE];
+      size_t n = x.printToBuffer(buf, hint);
+      if (n > 0) return write((const uint8_t *)buf, n);
+    }
+  }
   return x.printTo(*this);
 }
 
@@ -128,6 +143,13 @@ size_t Print::println(const String &s)
   return n;
 }
 
+size_t Print::println(const StringView &v)
+{
+  size_t n = print(v);
+  n += println();
+  return n;
+}
+
 size_t Print::println(const char c[])
 {
   size_t n = print(c);
@@ -194,10 +216,27 @@ size_t Print::println(const Printable& x)
 // Private Methods /////////////////////////////////////////////////////////////
 
 size_t Print::printNumber(unsigned long n, int base) {
-  char buf[8 * sizeof(long) + 1]; // Assumes 8-bit chars plus zero byte.
-  char *str = &buf[sizeof(buf) - 1];
+  char buf[PrintFormat::NUMBER_SIZE];
+  char *end = buf + sizeof(buf);
+  char *str = PrintFormat::formatNumber(end, n, base);
+  return write((const uint8_t *)str, (size_t)(end - str));
+}
 
-  *str = '\0';
+size_t Print::printFloat(double number, int digits) 
+{ 
+  char local[64];
+  size_t size = PrintFormat::floatSize(digits);
+  char *buf = size <= sizeof(local) ? local : (char *)malloc(size);
+  if (!buf) return 0;
+  size_t n = write((const uint8_t *)buf, PrintFormat::formatFloat(buf, number, digits));
+  if (buf != local) free(buf);
+  return n;
+}
+
+// Number formatting ///////////////////////////////////////////////////////////
+
+char *PrintFormat::formatNumber(char *end, unsigned long n, int base) {
+  char *str = end;
 
   // prevent crash if called with base == 1
   if (base < 2) base = 10;
@@ -209,22 +248,21 @@ size_t Print::printNumber(unsigned long n, int base) {
     *--str = c < 10 ? (char)(c + '0') : (char)(c + 'A' - 10);
   } while(n);
 
-  return write(str);
+  return str;
 }
 
-size_t Print::printFloat(double number, int digits) 
+size_t PrintFormat::formatFloat(char *buf, double number, int digits) 
 { 
-  size_t n = 0;
+  char *p = buf;
   
-  if (isnan(number)) return print("nan");
-  if (isinf(number)) return print("inf");
-  if (number > 4294967040.0) return print ("ovf");  // constant determined empirically
-  if (number <-4294967040.0) return print ("ovf");  // constant determined empirically
+  if (isnan(number)) { memcpy(buf, "nan", 3); return 3; }
+  if (isinf(number)) { memcpy(buf, "inf", 3); return 3; }
+  if (number > 4294967040.0 || number <-4294967040.0) { memcpy(buf, "ovf", 3); return 3; }  // constant determined empirically
   
   // Handle negative numbers
   if (number < 0.0)
   {
-     n += print('-');
+     *p++ = '-';
      number = -number;
   }
 
@@ -238,11 +276,15 @@ size_t Print::printFloat(double number, int digits)
   // Extract the integer part of the number and print it
   unsigned long int_part = (unsigned long)number;
   double remainder = number - (double)int_part;
-  n += print(int_part);
+  char digitbuf[NUMBER_SIZE];
+  char *end = digitbuf + sizeof(digitbuf);
+  char *str = formatNumber(end, int_part, 10);
+  memcpy(p, str, (size_t)(end - str));
+  p += end - str;
 
   // Print the decimal point, but only if there are digits beyond
   if (digits > 0) {
-    n += print("."); 
+    *p++ = '.';
   }
 
   // Extract digits from the remainder one at a time
@@ -250,9 +292,32 @@ size_t Print::printFloat(double number, int digits)
   {
     remainder *= 10.0;
     int toPrint = int(remainder);
-    n += print(toPrint);
+    *p++ = (char)('0' + toPrint);
     remainder -= toPrint; 
   } 
   
-  return n;
+  return (size_t)(p - buf);
+}
+
+size_t PrintFormat::formatDouble(char *buf, double number, int digits)
+{
+  if (digits < 0) digits = 0;
+  if (digits > 17) digits = 17;
+  if (number > 4294967040.0 || number < -4294967040.0) {
+    return (size_t)snprintf(buf, floatSize(17), "%.*e", digits, number);
+  }
+  return formatFloat(buf, number, digits);
+}
+
+bool PrintFormat::growBuffer(char *&buf, size_t &cap, size_t needed)
+{
+  if (cap >= needed) return true;
+  size_t newcap = cap + (cap >> 1);
+  if (newcap < needed) newcap = needed;
+  if (newcap < 256) newcap = 256;
+  char *newbuf = (char *)realloc(buf, newcap);
+  if (!newbuf) return false;
+  buf = newbuf;
+  cap = newcap;
+  return true;
 }
@@ -28,12 +28,43 @@
 
 #include "WString.h"
 #include "Printable.h"
+#include "PrintMetrics.h"
 
 #define DEC 10
 #define HEX 16
 #define OCT 8
 #define BIN 2
 
+// Printables with a size hint up to this size are rendered on the stack
+// by print(const Printable&) when the sink has no buffer of its own
+#ifndef PRINT_STACK_BUFFER_SIZE
+#define PRINT_STACK_BUFFER_SIZE 256
+#endif
+
+// Number formatting shared by Print and BasicPrint (see BasicPrint.h),
+// into caller buffers so every number is written at once
+struct PrintFormat
+{
+  // buffer size for any unsigned long in any base, plus a sign
+  enum { NUMBER_SIZE = 8 * sizeof(unsigned long) + 1 };
+  // buffer size for a double printed with the given number of decimals
+  static size_t floatSize(int digits) { return 14 + (digits > 0 ? (size_t)digits : 0); }
+
+  // writes n in base (10 if base < 2) just before end, returns the first
+  // character
+  static char *formatNumber(char *end, unsigned long n, int base);
+  // writes number as Print::print(double, digits) does, returns the length
+  static size_t formatFloat(char *buf, double number, int digits);
+  // formatFloat() for writers that need the number whatever its size:
+  // past the 32 bit range ("ovf" for print()) it is written as %.*e.
+  // digits is clamped to [0, 17], buf holds floatSize(17) bytes.
+  static size_t formatDouble(char *buf, double number, int digits);
+
+  // grows a malloc()ed buffer by 1.5x (256 bytes at least) until it
+  // holds needed bytes; false, and the buffer unchanged, if out of memory
+  static bool growBuffer(char *&buf, size_t &cap, size_t needed);
+};
+
 class Print
 {
   private:
@@ -55,7 +86,21 @@ class Print
     }
     virtual size_t write(const uint8_t *buffer, size_t size);
 
+    // Optional direct access to the output buffer of the sink: returns
+    // room for size bytes, which must be followed by commitWrite() with
+    // the number of bytes filled (0 to cancel).  NULL (the default) when
+    // the sink has no buffer.
+    virtual uint8_t *reserveWrite(size_t) { return NULL; }
+    virtual size_t commitWrite(size_t) { return 0; }
+
+    // Bytes, calls and latencies of the sink so far (see PrintMetrics.h),
+    // all zero unless the sink is instrumented and the library is built
+    // with OUTPUTPRINT_METRICS
+    virtual PrintMetricsSnapshot metrics() const { return PrintMetricsSnapshot(); }
+    virtual void resetMetrics() {}
+
     size_t print(const String &);
+    size_t print(const StringView &);
     size_t print(const char[]);
     size_t print(char);
     size_t print(unsigned char, int = DEC);
@@ -67,6 +112,7 @@ class Print
     size_t print(const Printable&);
 
     size_t println(const String &s);
+    size_t println(const StringView &v);
     size_t println(const char[]);
     size_t println(char);
     size_t println(unsigned char, int = DEC);
@@ -0,0 +1,162 @@
+/*
+  PrintMetrics.cpp - Opt-in counters and latency histograms for Print
+  sinks.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <chrono>
+
+#include "Print.h"
+#include "PrintMetrics.h"
+
+// Snapshot ////////////////////////////////////////////////////////////////////
+
+uint64_t PrintLatency::percentileNanos(double percentile) const
+{
+  if (count == 0) return 0;
+  double target = (double)count * percentile / 100.0;
+  uint64_t seen = 0;
+  for (int i = 0; i < PRINT_METRICS_BUCKETS; i++) {
+    seen += buckets[i];
+    if ((double)seen >= target && seen > 0) {
+      uint64_t bound = (uint64_t)1 << (i + 1);
+      return bound < maxNanos ? bound : maxNanos;
+    }
+  }
+  return maxNanos;
+}
+
+// one line of the report
+static int printLatency(char *buf, size_t cap, const char *name, const PrintLatency &l)
+{
+  return snprintf(buf, cap, "%s latency: n %llu, mean %llu ns, p50 <= %llu ns, p99 <= %llu ns, max %llu ns\r\n",
+    name, (unsigned long long)l.count, (unsigned long long)l.meanNanos(),
+    (unsigned long long)l.percentileNanos(50), (unsigned long long)l.percentileNanos(99),
+    (unsigned long long)l.maxNanos);
+}
+
+size_t PrintMetricsSnapshot::printedSizeHint() const
+{
+  // fixed text plus up to 20 digits per number
+  return 3 * 80 + 15 * 20;
+}
+
+size_t PrintMetricsSnapshot::printToBuffer(char *buf, size_t cap) const
+{
+  int n = snprintf(buf, cap, "bytes %llu, writes %llu, flushes %llu, syscalls %llu, errors %llu\r\n",
+    (unsigned long long)bytes, (unsigned long long)writes, (unsigned long long)flushes,
+    (unsigned long long)syscalls, (unsigned long long)errors);
+  if (n < 0 || (size_t)n >= cap) return 0;
+  size_t len = (size_t)n;
+  n = printLatency(buf + len, cap - len, "write", writeLatency);
+  if (n < 0 || (size_t)n >= cap - len) return 0;
+  len += (size_t)n;
+  n = printLatency(buf + len, cap - len, "flush", flushLatency);
+  if (n < 0 || (size_t)n >= cap - len) return 0;
+  return len + (size_t)n;
+}
+
+size_t PrintMetricsSnapshot::printTo(Print &p) const
+{
+  char buf[3 * 80 + 15 * 20 + 1];  // snprintf() needs room for the '\0'
+  size_t n = printToBuffer(buf, sizeof(buf));
+  return p.write((const uint8_t *)buf, n);
+}
+
+// Live counters ///////////////////////////////////////////////////////////////
+
+uint64_t PrintMetrics::now()
+{
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline int bucketOf(uint64_t nanos)
+{
+  int bucket = 0;
+  while (nanos > 1 && bucket < PRINT_METRICS_BUCKETS - 1) {
+    nanos >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+void PrintMetrics::Latency::record(uint64_t nanos)
+{
+  count.fetch_add(1, std::memory_order_relaxed);
+  totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+  buckets[bucketOf(nanos)].fetch_add(1, std::memory_order_relaxed);
+  uint64_t max = maxNanos.load(std::memory_order_relaxed);
+  while (nanos > max && !maxNanos.compare_exchange_weak(max, nanos, std::memory_order_relaxed)) {}
+}
+
+void PrintMetrics::Latency::load(PrintLatency &to) const
+{
+  to.count = count.load(std::memory_order_relaxed);
+  to.totalNanos = totalNanos.load(std::memory_order_relaxed);
+  to.maxNanos = maxNanos.load(std::memory_order_relaxed);
+  for (int i = 0; i < PRINT_METRICS_BUCKETS; i++) to.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+}
+
+void PrintMetrics::Latency::reset()
+{
+  count.store(0, std::memory_order_relaxed);
+  totalNanos.store(0, std::memory_order_relaxed);
+  maxNanos.store(0, std::memory_order_relaxed);
+  for (int i = 0; i < PRINT_METRICS_BUCKETS; i++) buckets[i].store(0, std::memory_order_relaxed);
+}
+
+void PrintMetrics::recordWrite(size_t size, uint64_t nanos, bool ok)
+{
+  bytes.fetch_add(size, std::memory_order_relaxed);
+  writes.fetch_add(1, std::memory_order_relaxed);
+  if (!ok) errors.fetch_add(1, std::memory_order_relaxed);
+  writeLatency.record(nanos);
+}
+
+void PrintMetrics::recordFlush(uint64_t nanos, bool ok)
+{
+  flushes.fetch_add(1, std::memory_order_relaxed);
+  if (!ok) errors.fetch_add(1, std::memory_order_relaxed);
+  flushLatency.record(nanos);
+}
+
+PrintMetricsSnapshot PrintMetrics::snapshot() const
+{
+  PrintMetricsSnapshot s;
+  s.bytes = bytes.load(std::memory_order_relaxed);
+  s.writes = writes.load(std::memory_order_relaxed);
+  s.flushes = flushes.load(std::memory_order_relaxed);
+  s.syscalls = syscalls.load(std::memory_order_relaxed);
+  s.errors = errors.load(std::memory_order_relaxed);
+  writeLatency.load(s.writeLatency);
+  flushLatency.load(s.flushLatency);
+  return s;
+}
+
+void PrintMetrics::reset()
+{
+  bytes.store(0, std::memory_order_relaxed);
+  writes.store(0, std::memory_order_relaxed);
+  flushes.store(0, std::memory_order_relaxed);
+  syscalls.store(0, std::memory_order_relaxed);
+  errors.store(0, std::memory_order_relaxed);
+  writeLatency.reset();
+  flushLatency.reset();
+}
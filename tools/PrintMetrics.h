@@ -0,0 +1,126 @@
+/*
+  PrintMetrics.h - Opt-in counters and latency histograms for Print
+  sinks.  Recorded when OUTPUTPRINT_METRICS is defined, see the
+  PRINT_METRICS_* macros below.  Every Print answers metrics(), with
+  zeros for the sinks that aren't instrumented.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef PrintMetrics_h
+#define PrintMetrics_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <new>
+
+#include "Printable.h"
+
+// Latency histogram: bucket i counts durations of [2^i, 2^(i+1))
+// nanoseconds, bucket 0 also counts 0.
+#define PRINT_METRICS_BUCKETS 40
+
+struct PrintLatency
+{
+  uint64_t count;
+  uint64_t totalNanos;
+  uint64_t maxNanos;
+  uint64_t buckets[PRINT_METRICS_BUCKETS];
+
+  uint64_t meanNanos() const { return count ? totalNanos / count : 0; }
+  // upper bound of the given percentile (0 to 100), from the buckets
+  uint64_t percentileNanos(double percentile) const;
+};
+
+// Values of the counters at one point in time, printable as a report
+struct PrintMetricsSnapshot : public Printable
+{
+  uint64_t bytes;          // bytes accepted by the sink
+  uint64_t writes;         // write calls
+  uint64_t flushes;        // flush calls
+  uint64_t syscalls;       // fwrite(), fflush() or write(2) calls made
+  uint64_t errors;         // failed or short writes and flushes
+  PrintLatency writeLatency;
+  PrintLatency flushLatency;
+
+  size_t printTo(Print &p) const;
+  size_t printedSizeHint() const;
+  size_t printToBuffer(char *buf, size_t cap) const;
+};
+
+// Live counters of one sink, updated with relaxed atomics so any thread
+// can write to the sink while another one takes a snapshot
+class PrintMetrics
+{
+  private:
+    struct Latency {
+      std::atomic<uint64_t> count;
+      std::atomic<uint64_t> totalNanos;
+      std::atomic<uint64_t> maxNanos;
+      std::atomic<uint64_t> buckets[PRINT_METRICS_BUCKETS];
+      void record(uint64_t nanos);
+      void load(PrintLatency &to) const;
+      void reset();
+    };
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> writes;
+    std::atomic<uint64_t> flushes;
+    std::atomic<uint64_t> syscalls;
+    std::atomic<uint64_t> errors;
+    Latency writeLatency;
+    Latency flushLatency;
+
+    PrintMetrics(const PrintMetrics &);
+    PrintMetrics &operator = (const PrintMetrics &);
+
+  public:
+    PrintMetrics() { reset(); }
+
+    // monotonic clock in nanoseconds
+    static uint64_t now();
+
+    void recordWrite(size_t size, uint64_t nanos, bool ok);
+    void recordFlush(uint64_t nanos, bool ok);
+    void recordSyscall() { syscalls.fetch_add(1, std::memory_order_relaxed); }
+    PrintMetricsSnapshot snapshot() const;
+    void reset();
+};
+
+// Instrumentation points for sink implementations, they compile to
+// nothing unless OUTPUTPRINT_METRICS is defined.  The sink has a
+// "PrintMetrics *stats" member whatever the option, allocated by its
+// constructor only when the option is on, so a sink costs one pointer
+// without it.  Only the .cpp files of the sink use these macros, so a
+// program built without the option can link a library built with it.
+#ifdef OUTPUTPRINT_METRICS
+#define PRINT_METRICS_NEW() new (std::nothrow) PrintMetrics()
+#define PRINT_METRICS_START() uint64_t print_metrics_start = stats ? PrintMetrics::now() : 0
+#define PRINT_METRICS_WRITE(size, ok) \
+  do { if (stats) stats->recordWrite(size, PrintMetrics::now() - print_metrics_start, ok); } while (0)
+#define PRINT_METRICS_FLUSH(ok) \
+  do { if (stats) stats->recordFlush(PrintMetrics::now() - print_metrics_start, ok); } while (0)
+#define PRINT_METRICS_SYSCALL() do { if (stats) stats->recordSyscall(); } while (0)
+#else
+#define PRINT_METRICS_NEW() NULL
+#define PRINT_METRICS_START()
+#define PRINT_METRICS_WRITE(size, ok)
+#define PRINT_METRICS_FLUSH(ok)
+#define PRINT_METRICS_SYSCALL()
+#endif
+
+#endif
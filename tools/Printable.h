@@ -28,12 +28,22 @@ class Print;
     By deriving from Printable and implementing the printTo method, it will then be possible
     for users to print out instances of this class by passing them into the usual
     Print::print and Print::println methods.
+
+    Classes that know their printed size can also implement printedSizeHint() and
+    printToBuffer(), then Print::print renders them contiguously and writes them at once
+    instead of calling printTo() with many small writes.
 */
 
 class Printable
 {
   public:
     virtual size_t printTo(Print& p) const = 0;
+
+    // Upper bound of the characters printToBuffer() writes, 0 if unknown
+    virtual size_t printedSizeHint() const { return 0; }
+    // Renders into buf (at most cap characters, no '\0'), returns the number
+    // of characters written, 0 if not implemented or cap is too small
+    virtual size_t printToBuffer(char *, size_t) const { return 0; }
 };
 
 #endif
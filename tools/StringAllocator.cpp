@@ -0,0 +1,284 @@
+/*
+  StringAllocator.cpp - Pluggable allocators for the String heap buffers:
+  the default malloc() allocator, a bump arena released all at once and
+  size-class free-list pools.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#include "StringAllocator.h"
+
+// blocks are aligned to 16 bytes, like malloc() on 64 bit targets
+static inline size_t align16(size_t size)
+{
+	return (size + 15) & ~(size_t)15;
+}
+
+// Default allocator and current allocator ////////////////////////////////////
+
+class MallocAllocator : public StringAllocator
+{
+public:
+	void *allocate(size_t size) {return malloc(size);}
+	void *reallocate(void *block, size_t oldSize, size_t newSize) {(void)oldSize; return realloc(block, newSize);}
+	void deallocate(void *block, size_t size) {(void)size; free(block);}
+};
+
+void *StringAllocator::reallocate(void *block, size_t oldSize, size_t newSize)
+{
+	void *newblock = allocate(newSize);
+	if (!newblock) return NULL;
+	memcpy(newblock, block, oldSize < newSize ? oldSize : newSize);
+	deallocate(block, oldSize);
+	return newblock;
+}
+
+StringAllocator &StringAllocator::heap(void)
+{
+	// never destroyed: Strings with static storage free their buffers
+	// after the function statics are gone
+	static MallocAllocator *allocator = new MallocAllocator;
+	return *allocator;
+}
+
+// NULL means heap(), so no dynamic initialization is needed
+static std::atomic<StringAllocator *> default_allocator(NULL);
+// NULL means the default allocator
+static thread_local StringAllocator *current_allocator = NULL;
+
+StringAllocator &StringAllocator::current(void)
+{
+	if (current_allocator) return *current_allocator;
+	StringAllocator *allocator = default_allocator.load(std::memory_order_acquire);
+	return allocator ? *allocator : heap();
+}
+
+void StringAllocator::setCurrent(StringAllocator &allocator)
+{
+	current_allocator = &allocator;
+}
+
+void StringAllocator::setDefault(StringAllocator &allocator)
+{
+	default_allocator.store(&allocator, std::memory_order_release);
+}
+
+StringAllocatorScope::StringAllocatorScope(StringAllocator &allocator) : previous(current_allocator)
+{
+	StringAllocator::setCurrent(allocator);
+}
+
+StringAllocatorScope::~StringAllocatorScope()
+{
+	current_allocator = previous;
+}
+
+// Bump arena /////////////////////////////////////////////////////////////////
+
+struct StringArena::Chunk
+{
+	Chunk *next;
+	size_t size;   // usable bytes after the header
+};
+
+char *StringArena::chunkData(Chunk *chunk)
+{
+	return (char *)chunk + align16(sizeof(Chunk));
+}
+
+StringArena::StringArena(size_t _chunkSize)
+	: chunks(NULL), top(NULL), limit(NULL), last(NULL), chunkSize(align16(_chunkSize ? _chunkSize : 1)), usedBytes(0)
+{
+}
+
+StringArena::~StringArena()
+{
+	while (chunks) {
+		Chunk *next = chunks->next;
+		free(chunks);
+		chunks = next;
+	}
+}
+
+StringArena::Chunk *StringArena::newChunk(size_t size)
+{
+	Chunk *chunk = (Chunk *)malloc(align16(sizeof(Chunk)) + size);
+	if (!chunk) return NULL;
+	chunk->size = size;
+	return chunk;
+}
+
+void *StringArena::allocate(size_t size)
+{
+	size = align16(size ? size : 1);
+	if (size > (size_t)(limit - top)) {
+		if (size > chunkSize / 4) {
+			// big blocks get a chunk of their own, and the current chunk
+			// stays in use for the small ones
+			Chunk *chunk = newChunk(size);
+			if (!chunk) return NULL;
+			if (chunks) {
+				chunk->next = chunks->next;
+				chunks->next = chunk;
+			} else {
+				chunk->next = NULL;
+				chunks = chunk;
+			}
+			usedBytes += size;
+			return chunkData(chunk);
+		}
+		Chunk *chunk = newChunk(chunkSize);
+		if (!chunk) return NULL;
+		chunk->next = chunks;
+		chunks = chunk;
+		top = chunkData(chunk);
+		limit = top + chunkSize;
+	}
+	last = top;
+	top += size;
+	usedBytes += size;
+	return last;
+}
+
+void *StringArena::reallocate(void *block, size_t oldSize, size_t newSize)
+{
+	oldSize = align16(oldSize ? oldSize : 1);
+	newSize = align16(newSize ? newSize : 1);
+	// the last block grows or shrinks in place while the chunk has room
+	if (block == last && last + oldSize == top && newSize <= (size_t)(limit - last)) {
+		top = last + newSize;
+		usedBytes = usedBytes - oldSize + newSize;
+		return block;
+	}
+	return StringAllocator::reallocate(block, oldSize, newSize);
+}
+
+void StringArena::deallocate(void *block, size_t size)
+{
+	// only the last block can be given back, the rest waits for release()
+	size = align16(size ? size : 1);
+	if (block == last && last + size == top) {
+		top = last;
+		usedBytes -= size;
+		last = NULL;
+	}
+}
+
+void StringArena::release(void)
+{
+	Chunk *keep = NULL;
+	while (chunks) {
+		Chunk *next = chunks->next;
+		if (!keep && chunks->size == chunkSize) {
+			keep = chunks;
+			keep->next = NULL;
+		} else {
+			free(chunks);
+		}
+		chunks = next;
+	}
+	chunks = keep;
+	top = keep ? chunkData(keep) : NULL;
+	limit = keep ? top + chunkSize : NULL;
+	last = NULL;
+	usedBytes = 0;
+}
+
+// Size-class pools ///////////////////////////////////////////////////////////
+
+struct StringPoolAllocator::Slab
+{
+	Slab *next;
+};
+
+StringPoolAllocator::StringPoolAllocator() : slabs(NULL), top(NULL), limit(NULL)
+{
+	for (int i = 0; i < CLASSES; i++) freeLists[i] = NULL;
+}
+
+StringPoolAllocator::~StringPoolAllocator()
+{
+	while (slabs) {
+		Slab *next = slabs->next;
+		free(slabs);
+		slabs = next;
+	}
+}
+
+// index of the smallest class holding size bytes, -1 if too big
+int StringPoolAllocator::sizeClass(size_t size)
+{
+	int index = 0;
+	size_t classSize = (size_t)1 << MIN_SHIFT;
+	while (classSize < size) {
+		if (++index == CLASSES) return -1;
+		classSize <<= 1;
+	}
+	return index;
+}
+
+void *StringPoolAllocator::allocate(size_t size)
+{
+	int index = sizeClass(size);
+	if (index < 0) return malloc(size);
+	std::lock_guard<std::mutex> guard(lock);
+	void *block = freeLists[index];
+	if (block) {
+		freeLists[index] = *(void **)block;
+		return block;
+	}
+	size_t classSize = (size_t)1 << (MIN_SHIFT + index);
+	if (classSize > (size_t)(limit - top)) {
+		size_t headerSize = align16(sizeof(Slab));
+		Slab *slab = (Slab *)malloc(headerSize + SLAB_SIZE);
+		if (!slab) return NULL;
+		slab->next = slabs;
+		slabs = slab;
+		top = (char *)slab + headerSize;
+		limit = top + SLAB_SIZE;
+	}
+	block = top;
+	top += classSize;
+	return block;
+}
+
+void *StringPoolAllocator::reallocate(void *block, size_t oldSize, size_t newSize)
+{
+	int oldIndex = sizeClass(oldSize);
+	int newIndex = sizeClass(newSize);
+	// no lock here: the fallback goes through allocate() and deallocate()
+	// same class: the block already has room
+	if (oldIndex >= 0 && oldIndex == newIndex) return block;
+	if (oldIndex < 0 && newIndex < 0) return realloc(block, newSize);
+	return StringAllocator::reallocate(block, oldSize, newSize);
+}
+
+void StringPoolAllocator::deallocate(void *block, size_t size)
+{
+	int index = sizeClass(size);
+	if (index < 0) {
+		free(block);
+		return;
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	*(void **)block = freeLists[index];
+	freeLists[index] = block;
+}
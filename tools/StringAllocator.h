@@ -0,0 +1,157 @@
+/*
+  StringAllocator.h - Pluggable allocators for the String heap buffers:
+  the default malloc() allocator, a bump arena released all at once and
+  size-class free-list pools.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef StringAllocator_h
+#define StringAllocator_h
+#ifdef __cplusplus
+
+#include <stddef.h>
+#include <mutex>
+
+// A String heap buffer is allocated from the current allocator of the
+// thread, and remembers it: growing and freeing the buffer always go
+// back to the allocator it came from, whatever allocator is current
+// then, so Strings from different allocators can be mixed freely.
+// Copies only share a buffer of the allocator the destination uses,
+// otherwise the characters are copied; moves always take the buffer,
+// with its allocator, in O(1).
+//
+// Example, temporary Strings of a request released all at once:
+//
+//     StringArena arena;
+//     StringAllocatorScope scope(arena);
+//     ... handle the request ...
+//
+// Strings holding arena memory must not outlive the arena.
+class StringAllocator
+{
+public:
+	virtual ~StringAllocator() {}
+
+	// returns a block of at least size bytes, aligned for any type, or NULL
+	virtual void *allocate(size_t size) = 0;
+	// resizes a block, which may move; returns NULL and leaves the block
+	// unchanged on failure.  The default allocates, copies and frees.
+	virtual void *reallocate(void *block, size_t oldSize, size_t newSize);
+	// frees a block of size bytes returned by this allocator
+	virtual void deallocate(void *block, size_t size) = 0;
+
+	// Strings allocate through these, telling how many of the size bytes
+	// they need now, the rest being room to grow.  The defaults ignore
+	// it, allocators doing accounting can override them (see StringTrace.h)
+	virtual void *allocateFor(size_t size, size_t used) {(void)used; return allocate(size);}
+	virtual void *reallocateFor(void *block, size_t oldSize, size_t newSize, size_t used)
+		{(void)used; return reallocate(block, oldSize, newSize);}
+
+	// malloc(), realloc() and free()
+	static StringAllocator &heap(void);
+	// allocator for the new String buffers of the calling thread
+	static StringAllocator &current(void);
+	static void setCurrent(StringAllocator &allocator);
+	// allocator of the threads that did not call setCurrent(), heap()
+	// unless changed.  The allocator must be thread safe.
+	static void setDefault(StringAllocator &allocator);
+};
+
+// Makes an allocator current for the calling thread until the end of
+// the scope, then restores the previous one.
+class StringAllocatorScope
+{
+public:
+	explicit StringAllocatorScope(StringAllocator &allocator);
+	~StringAllocatorScope();
+
+private:
+	StringAllocator *previous;   // NULL for the default allocator
+
+	StringAllocatorScope(const StringAllocatorScope &);
+	StringAllocatorScope &operator = (const StringAllocatorScope &);
+};
+
+// Bump allocator: blocks are carved from large chunks and individual
+// frees are no-ops (except for the last block, which can also grow in
+// place).  All the memory is returned by release() or the destructor.
+// Not thread safe, use one arena per thread, and don't pass its Strings
+// (or copies of them) to other threads.
+class StringArena : public StringAllocator
+{
+public:
+	explicit StringArena(size_t chunkSize = 65536);
+	~StringArena();
+
+	void *allocate(size_t size);
+	void *reallocate(void *block, size_t oldSize, size_t newSize);
+	void deallocate(void *block, size_t size);
+
+	// frees every block at once, keeping one chunk for reuse
+	void release(void);
+	// bytes handed out since the last release()
+	size_t used(void) const {return usedBytes;}
+
+private:
+	struct Chunk;
+	Chunk *chunks;       // most recent first
+	char *top;           // free space of the current chunk is [top, limit)
+	char *limit;
+	char *last;          // last block allocated, NULL if freed
+	size_t chunkSize;
+	size_t usedBytes;
+
+	Chunk *newChunk(size_t size);
+	static char *chunkData(Chunk *chunk);
+
+	StringArena(const StringArena &);
+	StringArena &operator = (const StringArena &);
+};
+
+// Free lists of power of two size classes, from 32 to 4096 bytes, carved
+// from large slabs; freed blocks are reused by later allocations of the
+// same class.  Larger blocks use malloc().  Memory is returned to the
+// system by the destructor.  Thread safe: copies share buffers, so the
+// last copy of a String may free its buffer on any thread.
+class StringPoolAllocator : public StringAllocator
+{
+public:
+	StringPoolAllocator();
+	~StringPoolAllocator();
+
+	void *allocate(size_t size);
+	void *reallocate(void *block, size_t oldSize, size_t newSize);
+	void deallocate(void *block, size_t size);
+
+private:
+	enum {MIN_SHIFT = 5, CLASSES = 8, SLAB_SIZE = 65536};
+	struct Slab;
+	void *freeLists[CLASSES];
+	Slab *slabs;
+	char *top;           // unused space of the current slab is [top, limit)
+	char *limit;
+	std::mutex lock;     // guards the free lists and the slabs
+
+	static int sizeClass(size_t size);
+
+	StringPoolAllocator(const StringPoolAllocator &);
+	StringPoolAllocator &operator = (const StringPoolAllocator &);
+};
+
+#endif  // __cplusplus
+#endif  // StringAllocator_h
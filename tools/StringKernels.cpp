@@ -0,0 +1,564 @@
+/*
+  StringKernels.cpp - Length driven, binary safe byte scanning kernels
+  used by the String class.  SSE2 is used when the target supports it,
+  with a portable scalar fallback otherwise.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <string.h>
+
+#include "StringKernels.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STRING_KERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Bit helpers for the 16 bit compare masks ////////////////////////////////////
+
+static inline unsigned int lowestBit(unsigned int mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (unsigned int)index;
+#else
+	return (unsigned int)__builtin_ctz(mask);
+#endif
+}
+
+static inline unsigned int highestBit(unsigned int mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse(&index, mask);
+	return (unsigned int)index;
+#else
+	return 31u - (unsigned int)__builtin_clz(mask);
+#endif
+}
+
+static inline unsigned int bitCount(unsigned int mask)
+{
+	mask = mask - ((mask >> 1) & 0x55555555u);
+	mask = (mask & 0x33333333u) + ((mask >> 2) & 0x33333333u);
+	return (((mask + (mask >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24;
+}
+
+#ifdef STRING_KERNELS_SSE2
+static inline unsigned int matchMask(const char *p, __m128i c)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, c));
+}
+#endif
+
+// Byte search /////////////////////////////////////////////////////////////////
+
+const char *StringKernels::findByte(const char *s, size_t n, char c)
+{
+	// libc memchr() is already vectorized and length driven
+	if (n == 0) return NULL;
+	return (const char *)memchr(s, c, n);
+}
+
+const char *StringKernels::findLastByte(const char *s, size_t n, char c)
+{
+#ifdef STRING_KERNELS_SSE2
+	__m128i vc = _mm_set1_epi8(c);
+	while (n >= 16) {
+		n -= 16;
+		unsigned int mask = matchMask(s + n, vc);
+		if (mask) return s + n + highestBit(mask);
+	}
+#endif
+	while (n--) {
+		if (s[n] == c) return s + n;
+	}
+	return NULL;
+}
+
+size_t StringKernels::countByte(const char *s, size_t n, char c)
+{
+	size_t count = 0;
+	size_t i = 0;
+#ifdef STRING_KERNELS_SSE2
+	__m128i vc = _mm_set1_epi8(c);
+	for (; i + 16 <= n; i += 16) {
+		count += bitCount(matchMask(s + i, vc));
+	}
+#endif
+	for (; i < n; i++) {
+		if (s[i] == c) count++;
+	}
+	return count;
+}
+
+const char *StringKernels::findAnyByte(const char *s, size_t n, const char *set, size_t setlen)
+{
+	if (setlen == 0 || n == 0) return NULL;
+	if (setlen == 1) return findByte(s, n, set[0]);
+	size_t i = 0;
+#ifdef STRING_KERNELS_SSE2
+	// small sets: one compare per set byte and 16 bytes per step
+	if (setlen <= 8) {
+		__m128i vset[8];
+		for (size_t k = 0; k < setlen; k++) vset[k] = _mm_set1_epi8(set[k]);
+		for (; i + 16 <= n; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(const void *)(s + i));
+			__m128i hit = _mm_cmpeq_epi8(v, vset[0]);
+			for (size_t k = 1; k < setlen; k++) hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, vset[k]));
+			unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+			if (mask) return s + i + lowestBit(mask);
+		}
+	}
+#endif
+	unsigned char table[256];
+	memset(table, 0, sizeof(table));
+	for (size_t k = 0; k < setlen; k++) table[(unsigned char)set[k]] = 1;
+	for (; i < n; i++) {
+		if (table[(unsigned char)s[i]]) return s + i;
+	}
+	return NULL;
+}
+
+// Substring search ////////////////////////////////////////////////////////////
+//
+// Candidates are positions where both the first and the last byte of the
+// needle match, tested 16 positions at a time; only those are verified
+// with memcmp().  This filters out nearly every false start on real text.
+
+const char *StringKernels::findBytes(const char *s, size_t n, const char *needle, size_t nlen)
+{
+	if (nlen == 0) return s;
+	if (nlen > n) return NULL;
+	if (nlen == 1) return findByte(s, n, needle[0]);
+	size_t last = n - nlen;   // last possible start position
+	size_t i = 0;
+#ifdef STRING_KERNELS_SSE2
+	__m128i first = _mm_set1_epi8(needle[0]);
+	__m128i tail = _mm_set1_epi8(needle[nlen - 1]);
+	for (; i + 15 <= last; i += 16) {
+		unsigned int mask = matchMask(s + i, first) & matchMask(s + i + nlen - 1, tail);
+		while (mask) {
+			unsigned int bit = lowestBit(mask);
+			if (memcmp(s + i + bit + 1, needle + 1, nlen - 2) == 0) return s + i + bit;
+			mask &= mask - 1;
+		}
+	}
+#endif
+	while (i <= last) {
+		const char *p = (const char *)memchr(s + i, needle[0], last - i + 1);
+		if (!p) return NULL;
+		if (memcmp(p + 1, needle + 1, nlen - 1) == 0) return p;
+		i = (size_t)(p - s) + 1;
+	}
+	return NULL;
+}
+
+const char *StringKernels::findLastBytes(const char *s, size_t n, const char *needle, size_t nlen)
+{
+	if (nlen == 0) return s + n;
+	if (nlen > n) return NULL;
+	if (nlen == 1) return findLastByte(s, n, needle[0]);
+	size_t end = n - nlen + 1;   // start positions still to test: [0, end)
+#ifdef STRING_KERNELS_SSE2
+	__m128i first = _mm_set1_epi8(needle[0]);
+	__m128i tail = _mm_set1_epi8(needle[nlen - 1]);
+	while (end >= 16) {
+		end -= 16;
+		unsigned int mask = matchMask(s + end, first) & matchMask(s + end + nlen - 1, tail);
+		while (mask) {
+			unsigned int bit = highestBit(mask);
+			if (memcmp(s + end + bit + 1, needle + 1, nlen - 2) == 0) return s + end + bit;
+			mask &= ~(1u << bit);
+		}
+	}
+#endif
+	while (end--) {
+		if (s[end] == needle[0] && memcmp(s + end + 1, needle + 1, nlen - 1) == 0) return s + end;
+	}
+	return NULL;
+}
+
+
+// ASCII case and whitespace ///////////////////////////////////////////////////
+//
+// Bytes >= 0x80 are negative as signed chars, so the signed range compares
+// below never treat them as letters or whitespace.
+
+static inline char lowerAscii(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? (char)(c | 0x20) : c;
+}
+
+static inline bool isSpaceAscii(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+#ifdef STRING_KERNELS_SSE2
+// 0x20 in every byte that is within [lo, hi], 0 elsewhere
+static inline __m128i caseBit(__m128i v, char lo, char hi)
+{
+	__m128i in = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((char)(lo - 1))),
+		_mm_cmplt_epi8(v, _mm_set1_epi8((char)(hi + 1))));
+	return _mm_and_si128(in, _mm_set1_epi8(0x20));
+}
+
+static inline __m128i lowerAscii(__m128i v)
+{
+	return _mm_or_si128(v, caseBit(v, 'A', 'Z'));
+}
+
+static inline unsigned int spaceMask(const char *p)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
+	__m128i ctl = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+		_mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+	__m128i sp = _mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+	return (unsigned int)_mm_movemask_epi8(sp);
+}
+#endif
+
+void StringKernels::toLowerAscii(char *s, size_t n)
+{
+	size_t i = 0;
+#ifdef STRING_KERNELS_SSE2
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(const void *)(s + i));
+		_mm_storeu_si128((__m128i *)(void *)(s + i), _mm_or_si128(v, caseBit(v, 'A', 'Z')));
+	}
+#endif
+	for (; i < n; i++) s[i] = lowerAscii(s[i]);
+}
+
+void StringKernels::toUpperAscii(char *s, size_t n)
+{
+	size_t i = 0;
+#ifdef STRING_KERNELS_SSE2
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(const void *)(s + i));
+		_mm_storeu_si128((__m128i *)(void *)(s + i), _mm_xor_si128(v, caseBit(v, 'a', 'z')));
+	}
+#endif
+	for (; i < n; i++) {
+		if (s[i] >= 'a' && s[i] <= 'z') s[i] = (char)(s[i] & ~0x20);
+	}
+}
+
+bool StringKernels::equalsIgnoreCaseAscii(const char *a, const char *b, size_t n)
+{
+	if (n == 0) return true;
+	// cheap early exit, most mismatching keys differ at an end
+	if (lowerAscii(a[0]) != lowerAscii(b[0]) || lowerAscii(a[n - 1]) != lowerAscii(b[n - 1])) return false;
+	size_t i = 0;
+#ifdef STRING_KERNELS_SSE2
+	for (; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(const void *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(const void *)(b + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(lowerAscii(va), lowerAscii(vb))) != 0xFFFF) return false;
+	}
+#endif
+	for (; i < n; i++) {
+		if (lowerAscii(a[i]) != lowerAscii(b[i])) return false;
+	}
+	return true;
+}
+
+size_t StringKernels::spanSpace(const char *s, size_t n)
+{
+	size_t i = 0;
+#ifdef STRING_KERNELS_SSE2
+	for (; i + 16 <= n; i += 16) {
+		unsigned int mask = spaceMask(s + i) ^ 0xFFFFu;
+		if (mask) return i + lowestBit(mask);
+	}
+#endif
+	while (i < n && isSpaceAscii(s[i])) i++;
+	return i;
+}
+
+size_t StringKernels::spanSpaceBack(const char *s, size_t n)
+{
+	size_t end = n;
+#ifdef STRING_KERNELS_SSE2
+	while (end >= 16) {
+		unsigned int mask = spaceMask(s + end - 16) ^ 0xFFFFu;
+		if (mask) return n - (end - 16 + highestBit(mask) + 1);
+		end -= 16;
+	}
+#endif
+	while (end > 0 && isSpaceAscii(s[end - 1])) end--;
+	return n - end;
+}
+
+// JSON escaping ///////////////////////////////////////////////////////////////
+
+static inline bool isJsonPlain(char c)
+{
+	return (unsigned char)c >= 0x20 && c != '"' && c != '\\';
+}
+
+size_t StringKernels::spanJsonPlain(const char *s, size_t n)
+{
+	size_t i = 0;
+#ifdef STRING_KERNELS_SSE2
+	// bytes <= 0x1F unsigned are the ones that saturate to 0
+	__m128i ctl = _mm_set1_epi8(0x1F);
+	__m128i quote = _mm_set1_epi8('"');
+	__m128i backslash = _mm_set1_epi8('\\');
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(const void *)(s + i));
+		__m128i hit = _mm_cmpeq_epi8(_mm_subs_epu8(v, ctl), _mm_setzero_si128());
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, quote));
+		hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, backslash));
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+		if (mask) return i + lowestBit(mask);
+	}
+#endif
+	while (i < n && isJsonPlain(s[i])) i++;
+	return i;
+}
+
+// UTF-8 ///////////////////////////////////////////////////////////////////////
+//
+// ASCII runs are skipped 64 bytes at a time; multibyte sequences are
+// checked one by one against the well-formed ranges of the Unicode
+// standard (table 3-7), which rejects overlong forms, surrogates and
+// code points above U+10FFFF.
+
+size_t StringKernels::spanAscii(const char *s, size_t n)
+{
+	size_t i = 0;
+#ifdef STRING_KERNELS_SSE2
+	for (; i + 64 <= n; i += 64) {
+		const __m128i *p = (const __m128i *)(const void *)(s + i);
+		__m128i any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+		                           _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+		if (_mm_movemask_epi8(any)) break;
+	}
+	for (; i + 16 <= n; i += 16) {
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(const void *)(s + i)));
+		if (mask) return i + lowestBit(mask);
+	}
+#else
+	for (; i + 8 <= n; i += 8) {
+		uint64_t v;
+		memcpy(&v, s + i, 8);
+		if (v & 0x8080808080808080ull) break;
+	}
+#endif
+	while (i < n && (unsigned char)s[i] < 0x80) i++;
+	return i;
+}
+
+// length of the well-formed sequence starting with a non-ASCII byte at
+// p, 0 if it is malformed or cut by the end
+static inline size_t utf8Sequence(const unsigned char *p, size_t n)
+{
+	unsigned char c = p[0];
+	unsigned char lo = 0x80, hi = 0xBF;
+	if (c < 0xC2) return 0;
+	if (c < 0xE0) return n >= 2 && (p[1] & 0xC0) == 0x80 ? 2 : 0;
+	if (c < 0xF0) {
+		if (c == 0xE0) lo = 0xA0;
+		if (c == 0xED) hi = 0x9F;
+		return n >= 3 && p[1] >= lo && p[1] <= hi && (p[2] & 0xC0) == 0x80 ? 3 : 0;
+	}
+	if (c < 0xF5) {
+		if (c == 0xF0) lo = 0x90;
+		if (c == 0xF4) hi = 0x8F;
+		return n >= 4 && p[1] >= lo && p[1] <= hi && (p[2] & 0xC0) == 0x80 && (p[3] & 0xC0) == 0x80 ? 4 : 0;
+	}
+	return 0;
+}
+
+size_t StringKernels::spanUtf8(const char *s, size_t n)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	size_t i = 0;
+	while (i < n) {
+		if (p[i] < 0x80) {
+			i += spanAscii(s + i, n - i);
+			continue;
+		}
+		size_t k = utf8Sequence(p + i, n - i);
+		if (!k) break;
+		i += k;
+	}
+	return i;
+}
+
+static inline bool isContinuation(char c)
+{
+	return ((unsigned char)c & 0xC0) == 0x80;
+}
+
+#ifdef STRING_KERNELS_SSE2
+// continuation bytes 0x80 to 0xBF are the signed bytes below -64
+static inline __m128i continuationBytes(const char *p)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
+	return _mm_cmplt_epi8(v, _mm_set1_epi8(-64));
+}
+#endif
+
+size_t StringKernels::countCodePoints(const char *s, size_t n)
+{
+	size_t i = 0;
+	size_t continuations = 0;
+#ifdef STRING_KERNELS_SSE2
+	// per byte lane counters, summed before they can overflow
+	while (i + 16 <= n) {
+		__m128i lanes = _mm_setzero_si128();
+		for (unsigned int k = 0; k < 255 && i + 16 <= n; k++, i += 16) {
+			lanes = _mm_sub_epi8(lanes, continuationBytes(s + i));
+		}
+		__m128i sums = _mm_sad_epu8(lanes, _mm_setzero_si128());
+		continuations += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+	}
+#endif
+	for (; i < n; i++) continuations += isContinuation(s[i]);
+	return n - continuations;
+}
+
+size_t StringKernels::codePointOffset(const char *s, size_t n, size_t index)
+{
+	size_t i = 0;
+#ifdef STRING_KERNELS_SSE2
+	// skip whole blocks while the code point is further, it starts at a
+	// non-continuation byte
+	for (; i + 16 <= n; i += 16) {
+		unsigned int starts = 16 - bitCount((unsigned int)_mm_movemask_epi8(continuationBytes(s + i)));
+		if (starts > index) break;
+		index -= starts;
+	}
+#endif
+	for (; i < n; i++) {
+		if (isContinuation(s[i])) continue;
+		if (index == 0) return i;
+		index--;
+	}
+	return n;
+}
+
+long StringKernels::codePointAt(const char *s, size_t n)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	if (n == 0) return -1;
+	if (p[0] < 0x80) return p[0];
+	size_t k = utf8Sequence(p, n);
+	if (!k) return -1;
+	long c = p[0] & (0x7F >> k);
+	for (size_t i = 1; i < k; i++) c = (c << 6) | (p[i] & 0x3F);
+	return c;
+}
+
+size_t StringKernels::utf8Boundary(const char *s, size_t n, size_t max)
+{
+	size_t end = max < n ? max : n;
+	// start of the last character beginning before end
+	size_t start = end;
+	for (int k = 0; k < 4 && start > 0 && isContinuation(s[start - 1]); k++) start--;
+	if (start == 0) return end;
+	start--;
+	unsigned char c = (unsigned char)s[start];
+	size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+	return start + need <= end ? end : start;
+}
+
+// Hashing /////////////////////////////////////////////////////////////////////
+//
+// Multiply-fold hashing: 16 bytes per step are folded into the state with
+// one 64 x 64 -> 128 bit multiply, whose halves are xored together.
+
+static inline uint64_t read64(const char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t read32(const char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t foldMultiply(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 r = (unsigned __int128)a * b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+	uint64_t hi;
+	uint64_t lo = _umul128(a, b, &hi);
+	return lo ^ hi;
+#else
+	uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+	uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+	uint64_t t = ll + (hl << 32);
+	uint64_t carry = t < ll;
+	uint64_t lo = t + (lh << 32);
+	carry += lo < t;
+	uint64_t hi = hh + (hl >> 32) + (lh >> 32) + carry;
+	return lo ^ hi;
+#endif
+}
+
+uint64_t StringKernels::hashBytes(const char *s, size_t n)
+{
+	const uint64_t k0 = 0x2d358dccaa6c78a5ull;
+	const uint64_t k1 = 0x8bb84b93962eacc9ull;
+	const uint64_t k2 = 0x4b33a62ed433d4a3ull;
+	uint64_t seed = foldMultiply((uint64_t)n ^ k0, k1);
+	uint64_t a, b;
+	if (n <= 16) {
+		if (n >= 8) {
+			a = read64(s);
+			b = read64(s + n - 8);
+		} else if (n >= 4) {
+			a = read32(s);
+			b = read32(s + n - 4);
+		} else if (n > 0) {
+			a = ((uint64_t)(unsigned char)s[0] << 16) | ((uint64_t)(unsigned char)s[n >> 1] << 8) | (unsigned char)s[n - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = n;
+		while (i > 16) {
+			seed = foldMultiply(read64(s) ^ k1, read64(s + 8) ^ seed);
+			s += 16;
+			i -= 16;
+		}
+		// the last 16 bytes, overlapping the previous block if needed
+		a = read64(s + i - 16);
+		b = read64(s + i - 8);
+	}
+	uint64_t h = foldMultiply(a ^ k1, b ^ seed);
+	h = foldMultiply(h ^ k2, (uint64_t)n ^ k0);
+	return h ? h : 1;
+}
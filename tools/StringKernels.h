@@ -0,0 +1,86 @@
+/*
+  StringKernels.h - Length driven, binary safe byte scanning kernels
+  used by the String class.  SSE2 is used when the target supports it,
+  with a portable scalar fallback otherwise.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef StringKernels_h
+#define StringKernels_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// All kernels take explicit lengths, never read past them and never
+// stop at '\0'.  Searches return NULL when nothing is found.
+struct StringKernels
+{
+	// first / last occurrence of the byte c
+	static const char *findByte(const char *s, size_t n, char c);
+	static const char *findLastByte(const char *s, size_t n, char c);
+
+	// first / last occurrence of needle, an empty needle matches at the
+	// start / end of s
+	static const char *findBytes(const char *s, size_t n, const char *needle, size_t nlen);
+	static const char *findLastBytes(const char *s, size_t n, const char *needle, size_t nlen);
+
+	// first occurrence of any of the bytes of set
+	static const char *findAnyByte(const char *s, size_t n, const char *set, size_t setlen);
+
+	// number of occurrences of the byte c
+	static size_t countByte(const char *s, size_t n, char c);
+
+	// ASCII case conversion in place, other bytes are left unchanged, so
+	// no locale lookup is needed (same result as the "C" locale)
+	static void toLowerAscii(char *s, size_t n);
+	static void toUpperAscii(char *s, size_t n);
+	// ASCII case insensitive equality of two buffers of n bytes
+	static bool equalsIgnoreCaseAscii(const char *a, const char *b, size_t n);
+
+	// number of leading / trailing whitespace bytes, as isspace() in the
+	// "C" locale: ' ', '\t', '\n', '\v', '\f' and '\r'
+	static size_t spanSpace(const char *s, size_t n);
+	static size_t spanSpaceBack(const char *s, size_t n);
+
+	// number of leading bytes that can go in a JSON string as they are:
+	// all but '"', '\\' and the control characters below 0x20
+	static size_t spanJsonPlain(const char *s, size_t n);
+
+	// UTF-8: number of leading ASCII bytes, and of leading bytes that are
+	// well-formed UTF-8 (no overlong forms, surrogates or code points
+	// above U+10FFFF, no sequence cut by the end).  Only ASCII runs are
+	// vectorized; multibyte sequences are checked one at a time by scalar
+	// code, since vector validation of them needs byte shuffles (SSSE3)
+	static size_t spanAscii(const char *s, size_t n);
+	static size_t spanUtf8(const char *s, size_t n);
+	// number of code points, the bytes that aren't continuation bytes
+	static size_t countCodePoints(const char *s, size_t n);
+	// byte offset of the code point at index, n if there are fewer
+	static size_t codePointOffset(const char *s, size_t n, size_t index);
+	// the code point starting at s, -1 if the sequence is malformed
+	static long codePointAt(const char *s, size_t n);
+	// longest prefix of at most max bytes that doesn't end inside a
+	// multibyte character
+	static size_t utf8Boundary(const char *s, size_t n, size_t max);
+
+	// fast non-cryptographic 64 bit hash, never 0 so callers can use 0
+	// as "not computed yet"
+	static uint64_t hashBytes(const char *s, size_t n);
+};
+
+#endif  // StringKernels_h
@@ -0,0 +1,264 @@
+/*
+  StringTrace.cpp - Allocation tracing for the String heap buffers: event
+  and byte counters, slack accounting and sampled call sites.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "StringTrace.h"
+#include "Print.h"
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#define STRING_TRACE_BACKTRACE
+#endif
+
+// Each block carries a small header with the bytes requested for it, so
+// frees and reallocations can update the live slack
+struct TraceHeader
+{
+	size_t used;
+};
+
+static const size_t trace_header_size = (sizeof(TraceHeader) + 15) & ~(size_t)15;
+
+// event counters of the calling thread
+static thread_local StringTraceStats thread_stats;
+// allocations left until the next sample in this thread
+static thread_local unsigned int sample_countdown = 0;
+
+StringTracer::StringTracer(StringAllocator &_target)
+	: target(_target), allocations(0), reallocations(0), frees(0), bytesRequested(0), bytesHeld(0),
+	  liveBytes(0), liveUsed(0), peakLiveBytes(0), sampleEvery(0), droppedSamples(0)
+{
+	memset(sites, 0, sizeof(sites));
+}
+
+void StringTracer::recordLive(size_t oldSize, size_t newSize, size_t oldUsed, size_t newUsed)
+{
+	// unsigned wrap around keeps the sums right whatever the order
+	size_t live = liveBytes.fetch_add(newSize - oldSize, std::memory_order_relaxed) + newSize - oldSize;
+	liveUsed.fetch_add(newUsed - oldUsed, std::memory_order_relaxed);
+	size_t peak = peakLiveBytes.load(std::memory_order_relaxed);
+	while (live > peak && !peakLiveBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+}
+
+void *StringTracer::allocateFor(size_t size, size_t used)
+{
+	void *block = target.allocate(trace_header_size + size);
+	if (!block) return NULL;
+	((TraceHeader *)block)->used = used;
+
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	bytesRequested.fetch_add(used, std::memory_order_relaxed);
+	bytesHeld.fetch_add(size, std::memory_order_relaxed);
+	recordLive(0, size, 0, used);
+	thread_stats.allocations++;
+	thread_stats.bytesRequested += used;
+	thread_stats.bytesHeld += size;
+	if (sampleEvery.load(std::memory_order_relaxed)) sample(size);
+	return (char *)block + trace_header_size;
+}
+
+void *StringTracer::reallocateFor(void *block, size_t oldSize, size_t newSize, size_t used)
+{
+	char *header = (char *)block - trace_header_size;
+	size_t oldUsed = ((TraceHeader *)header)->used;
+	void *newblock = target.reallocate(header, trace_header_size + oldSize, trace_header_size + newSize);
+	if (!newblock) return NULL;
+	((TraceHeader *)newblock)->used = used;
+
+	reallocations.fetch_add(1, std::memory_order_relaxed);
+	bytesRequested.fetch_add(used, std::memory_order_relaxed);
+	bytesHeld.fetch_add(newSize, std::memory_order_relaxed);
+	recordLive(oldSize, newSize, oldUsed, used);
+	thread_stats.reallocations++;
+	thread_stats.bytesRequested += used;
+	thread_stats.bytesHeld += newSize;
+	if (sampleEvery.load(std::memory_order_relaxed)) sample(newSize);
+	return (char *)newblock + trace_header_size;
+}
+
+void StringTracer::deallocate(void *block, size_t size)
+{
+	char *header = (char *)block - trace_header_size;
+	size_t used = ((TraceHeader *)header)->used;
+	frees.fetch_add(1, std::memory_order_relaxed);
+	liveBytes.fetch_sub(size, std::memory_order_relaxed);
+	liveUsed.fetch_sub(used, std::memory_order_relaxed);
+	thread_stats.frees++;
+	target.deallocate(header, trace_header_size + size);
+}
+
+StringTraceStats StringTracer::stats(void) const
+{
+	StringTraceStats s;
+	s.allocations = allocations.load(std::memory_order_relaxed);
+	s.reallocations = reallocations.load(std::memory_order_relaxed);
+	s.frees = frees.load(std::memory_order_relaxed);
+	s.bytesRequested = bytesRequested.load(std::memory_order_relaxed);
+	s.bytesHeld = bytesHeld.load(std::memory_order_relaxed);
+	s.liveBytes = liveBytes.load(std::memory_order_relaxed);
+	s.peakLiveBytes = peakLiveBytes.load(std::memory_order_relaxed);
+	size_t used = liveUsed.load(std::memory_order_relaxed);
+	s.liveSlack = s.liveBytes > used ? s.liveBytes - used : 0;
+	return s;
+}
+
+StringTraceStats StringTracer::threadStats(void)
+{
+	return thread_stats;
+}
+
+void StringTracer::reset(void)
+{
+	allocations.store(0, std::memory_order_relaxed);
+	reallocations.store(0, std::memory_order_relaxed);
+	frees.store(0, std::memory_order_relaxed);
+	bytesRequested.store(0, std::memory_order_relaxed);
+	bytesHeld.store(0, std::memory_order_relaxed);
+	peakLiveBytes.store(liveBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	thread_stats = StringTraceStats();
+	std::lock_guard<std::mutex> lock(sitesLock);
+	memset(sites, 0, sizeof(sites));
+	droppedSamples = 0;
+}
+
+void StringTracer::sampleCallSites(unsigned int every)
+{
+	sampleEvery.store(every, std::memory_order_relaxed);
+}
+
+// Call site sampling ////////////////////////////////////////////////////////
+
+void StringTracer::sample(size_t size)
+{
+	if (sample_countdown > 1) {
+		sample_countdown--;
+		return;
+	}
+	sample_countdown = sampleEvery.load(std::memory_order_relaxed);
+#ifdef STRING_TRACE_BACKTRACE
+	// skip this function and allocateFor() or reallocateFor()
+	void *frames[STRING_TRACE_FRAMES + 2];
+	int depth = backtrace(frames, STRING_TRACE_FRAMES + 2) - 2;
+	if (depth <= 0) return;
+	size_t hash = 14695981039346656037ULL & SIZE_MAX;
+	for (int i = 0; i < depth; i++) hash = (hash ^ (size_t)(uintptr_t)frames[i + 2]) * 1099511628211ULL;
+	if (hash == 0) hash = 1;
+
+	std::lock_guard<std::mutex> lock(sitesLock);
+	size_t slot = hash % STRING_TRACE_SITES;
+	for (size_t probes = 0; probes < STRING_TRACE_SITES; probes++) {
+		Site &site = sites[slot];
+		if (site.hash == 0) {
+			site.hash = hash;
+			memcpy(site.frames, frames + 2, (size_t)depth * sizeof(void *));
+			site.depth = depth;
+		}
+		if (site.hash == hash && site.depth == depth &&
+		    memcmp(site.frames, frames + 2, (size_t)depth * sizeof(void *)) == 0) {
+			site.samples++;
+			site.bytes += size;
+			return;
+		}
+		slot = (slot + 1) % STRING_TRACE_SITES;
+	}
+	droppedSamples++;
+#else
+	(void)size;
+#endif
+}
+
+// Report ////////////////////////////////////////////////////////////////////
+
+static size_t printCounter(Print &p, const char *name, size_t value)
+{
+	size_t n = p.print(name);
+	n += p.print((unsigned long)value);
+	return n;
+}
+
+// call sites shown in the report
+#define STRING_TRACE_TOP 10
+
+size_t StringTracer::printTo(Print &p) const
+{
+	StringTraceStats s = stats();
+	size_t n = 0;
+	n += printCounter(p, "String allocations ", s.allocations);
+	n += printCounter(p, ", reallocations ", s.reallocations);
+	n += printCounter(p, ", frees ", s.frees);
+	n += p.println();
+	n += printCounter(p, "bytes requested ", s.bytesRequested);
+	n += printCounter(p, ", held ", s.bytesHeld);
+	n += printCounter(p, ", slack ", s.bytesHeld - s.bytesRequested);
+	n += p.println();
+	n += printCounter(p, "live bytes ", s.liveBytes);
+	n += printCounter(p, ", peak ", s.peakLiveBytes);
+	n += printCounter(p, ", live slack ", s.liveSlack);
+	n += p.println();
+
+	unsigned int every = sampleEvery.load(std::memory_order_relaxed);
+	if (every == 0) return n;
+
+	// copy the busiest sites out of the lock, then print them
+	Site top[STRING_TRACE_TOP];
+	int count = 0;
+	size_t dropped;
+	{
+		std::lock_guard<std::mutex> lock(sitesLock);
+		for (int i = 0; i < STRING_TRACE_SITES; i++) {
+			if (sites[i].hash == 0) continue;
+			// insertion into top[], kept sorted by bytes
+			int pos = count < STRING_TRACE_TOP ? count++ : STRING_TRACE_TOP;
+			while (pos > 0 && top[pos - 1].bytes < sites[i].bytes) {
+				if (pos < STRING_TRACE_TOP) top[pos] = top[pos - 1];
+				pos--;
+			}
+			if (pos < STRING_TRACE_TOP) top[pos] = sites[i];
+		}
+		dropped = droppedSamples;
+	}
+
+	n += printCounter(p, "call sites, sampled 1 of ", every);
+	if (dropped) n += printCounter(p, ", samples not attributed ", dropped);
+	n += p.println();
+	for (int i = 0; i < count; i++) {
+		n += printCounter(p, "  samples ", top[i].samples);
+		n += printCounter(p, ", bytes ", top[i].bytes);
+		n += p.println();
+#ifdef STRING_TRACE_BACKTRACE
+		char **symbols = backtrace_symbols(top[i].frames, top[i].depth);
+		for (int f = 0; f < top[i].depth; f++) {
+			n += p.print("    ");
+			if (symbols) {
+				n += p.println(symbols[f]);
+			} else {
+				n += p.print("0x");
+				n += p.println((unsigned long)(uintptr_t)top[i].frames[f], HEX);
+			}
+		}
+		free(symbols);
+#endif
+	}
+	return n;
+}
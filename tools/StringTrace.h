@@ -0,0 +1,133 @@
+/*
+  StringTrace.h - Allocation tracing for the String heap buffers: event
+  and byte counters, slack accounting and sampled call sites.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef StringTrace_h
+#define StringTrace_h
+#ifdef __cplusplus
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+
+#include "StringAllocator.h"
+#include "Printable.h"
+
+// call sites kept by the sampling mode, and frames kept per call site
+#ifndef STRING_TRACE_SITES
+#define STRING_TRACE_SITES 256
+#endif
+#ifndef STRING_TRACE_FRAMES
+#define STRING_TRACE_FRAMES 8
+#endif
+
+// Counters of a StringTracer.  "Requested" bytes are the ones the String
+// needed when the block was allocated or resized, "held" bytes the size
+// of the block; the difference is the slack left by the growth policy
+// and reserve() (String heap headers included in both).
+struct StringTraceStats
+{
+	size_t allocations;
+	size_t reallocations;
+	size_t frees;
+	size_t bytesRequested;   // sum over allocations and reallocations
+	size_t bytesHeld;        // sum over allocations and reallocations
+	// live blocks, process wide only (0 in StringTracer::threadStats())
+	size_t liveBytes;
+	size_t peakLiveBytes;
+	size_t liveSlack;        // live bytes held but not requested
+};
+
+// Decorator counting the String allocations that go through it, then
+// forwarding them to another allocator (malloc() by default).  To trace
+// every thread:
+//
+//     StringTracer tracer;
+//     StringAllocator::setDefault(tracer);
+//     tracer.sampleCallSites(100);     // optional
+//     ... run ...
+//     Serial.print(tracer);            // report
+//
+// or trace one scope with a StringAllocatorScope.  Buffers allocated
+// before keep their allocator and are not counted.  The tracer must
+// outlive the Strings it allocated.
+//
+// Sampling records the stack of one allocation or reallocation out of
+// every N and groups them by call site, where backtrace() is available
+// (glibc and macOS); link with -rdynamic for function names.
+class StringTracer : public StringAllocator, public Printable
+{
+public:
+	explicit StringTracer(StringAllocator &target = StringAllocator::heap());
+
+	void *allocate(size_t size) {return allocateFor(size, size);}
+	void *reallocate(void *block, size_t oldSize, size_t newSize)
+		{return reallocateFor(block, oldSize, newSize, newSize);}
+	void deallocate(void *block, size_t size);
+	void *allocateFor(size_t size, size_t used);
+	void *reallocateFor(void *block, size_t oldSize, size_t newSize, size_t used);
+
+	// process wide counters of this tracer
+	StringTraceStats stats(void) const;
+	// event counters of the calling thread, all tracers together
+	static StringTraceStats threadStats(void);
+	// clears the event counters and the sampled call sites, the live
+	// counters keep following the blocks still allocated
+	void reset(void);
+
+	// records one call stack every "every" allocations, 0 stops
+	void sampleCallSites(unsigned int every);
+
+	// counters, then the call sites holding the most sampled bytes
+	size_t printTo(Print &p) const;
+
+private:
+	struct Site {
+		size_t hash;             // 0 if unused
+		void *frames[STRING_TRACE_FRAMES];
+		int depth;
+		size_t samples;
+		size_t bytes;
+	};
+
+	StringAllocator &target;
+	std::atomic<size_t> allocations;
+	std::atomic<size_t> reallocations;
+	std::atomic<size_t> frees;
+	std::atomic<size_t> bytesRequested;
+	std::atomic<size_t> bytesHeld;
+	std::atomic<size_t> liveBytes;
+	std::atomic<size_t> liveUsed;
+	std::atomic<size_t> peakLiveBytes;
+	std::atomic<unsigned int> sampleEvery;
+
+	mutable std::mutex sitesLock;
+	Site sites[STRING_TRACE_SITES];
+	size_t droppedSamples;   // samples of call sites beyond the table
+
+	void recordLive(size_t oldSize, size_t newSize, size_t oldUsed, size_t newUsed);
+	void sample(size_t size);
+
+	StringTracer(const StringTracer &);
+	StringTracer &operator = (const StringTracer &);
+};
+
+#endif  // __cplusplus
+#endif  // StringTrace_h
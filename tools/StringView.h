@@ -0,0 +1,91 @@
+/*
+  StringView.h - Non-owning view of a run of characters (pointer and
+  length), to slice, compare and print text without copying it.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef StringView_h
+#define StringView_h
+#ifdef __cplusplus
+
+#include <stddef.h>
+#include <string.h>
+
+#include "StringKernels.h"
+
+// A StringView doesn't own its characters: it is only valid as long as
+// the String (or buffer) it was taken from is alive and unmodified.  The
+// characters are not '\0' terminated, always use length().
+class StringView
+{
+public:
+	StringView() : ptr(""), len(0) {}
+	StringView(const char *data, size_t length) : ptr(data ? data : ""), len(data ? length : 0) {}
+	// explicit, so "string" arguments keep selecting the String overloads
+	explicit StringView(const char *cstr) : ptr(cstr ? cstr : ""), len(cstr ? strlen(cstr) : 0) {}
+
+	const char *data(void) const {return ptr;}
+	size_t length(void) const {return len;}
+	bool isEmpty(void) const {return len == 0;}
+	char operator [] (size_t index) const {return index < len ? ptr[index] : 0;}
+
+	// view of the characters [beginIndex, endIndex), clamped to the view
+	StringView subview(size_t beginIndex) const {return subview(beginIndex, len);}
+	StringView subview(size_t beginIndex, size_t endIndex) const {
+		if (beginIndex > endIndex) {size_t t = beginIndex; beginIndex = endIndex; endIndex = t;}
+		if (beginIndex > len) return StringView(ptr + len, 0);
+		if (endIndex > len) endIndex = len;
+		return StringView(ptr + beginIndex, endIndex - beginIndex);
+	}
+
+	bool equals(const StringView &v) const {return len == v.len && (ptr == v.ptr || memcmp(ptr, v.ptr, len) == 0);}
+	bool operator == (const StringView &v) const {return equals(v);}
+	bool operator != (const StringView &v) const {return !equals(v);}
+	bool startsWith(const StringView &v) const {return v.len <= len && memcmp(ptr, v.ptr, v.len) == 0;}
+	bool endsWith(const StringView &v) const {return v.len <= len && memcmp(ptr + len - v.len, v.ptr, v.len) == 0;}
+
+	// UTF-8, see StringKernels.h
+	bool isAscii(void) const {return StringKernels::spanAscii(ptr, len) == len;}
+	bool isValidUtf8(void) const {return StringKernels::spanUtf8(ptr, len) == len;}
+	size_t utf8Length(void) const {return StringKernels::countCodePoints(ptr, len);}
+	// longest prefix of at most maxBytes bytes that doesn't split a
+	// character, to print into size limited sinks
+	StringView utf8Prefix(size_t maxBytes) const {return StringView(ptr, StringKernels::utf8Boundary(ptr, len, maxBytes));}
+
+	// same hash as String::hash()
+	uint64_t hash(void) const {return StringKernels::hashBytes(ptr, len);}
+
+	// position of the first occurrence, or -1
+	long indexOf(char c, size_t fromIndex = 0) const {
+		if (fromIndex >= len) return -1;
+		const char *p = StringKernels::findByte(ptr + fromIndex, len - fromIndex, c);
+		return p ? (long)(p - ptr) : -1;
+	}
+	long indexOf(const StringView &v, size_t fromIndex = 0) const {
+		if (fromIndex > len) return -1;
+		const char *p = StringKernels::findBytes(ptr + fromIndex, len - fromIndex, v.ptr, v.len);
+		return p ? (long)(p - ptr) : -1;
+	}
+
+private:
+	const char *ptr;
+	size_t len;
+};
+
+#endif  // __cplusplus
+#endif  // StringView_h
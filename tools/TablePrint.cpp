@@ -0,0 +1,171 @@
+/*
+  TablePrint.cpp - CSV / TSV table writer on top of any Print: typed cells,
+  RFC 4180 quoting when needed, whole rows written at once.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "TablePrint.h"
+#include "StringKernels.h"
+
+TablePrint::TablePrint(Print &_output, const char *const *_columns, size_t count, char _separator)
+  : output(_output), separator(_separator), names(NULL), column_count(count), cells(0), write_error(0),
+    buf(NULL), len(0), cap(0), row_start(0), block_size(0), broken(false)
+{
+  if (count == 0) return;
+  names = new String[count];
+  for (size_t i = 0; i < count; i++) names[i] = _columns[i];
+}
+
+TablePrint::TablePrint(Print &_output, size_t count, char _separator)
+  : output(_output), separator(_separator), names(NULL), column_count(count), cells(0), write_error(0),
+    buf(NULL), len(0), cap(0), row_start(0), block_size(0), broken(false)
+{
+}
+
+TablePrint::~TablePrint()
+{
+  flush();
+  free(buf);
+  delete[] names;
+}
+
+// Row buffer //////////////////////////////////////////////////////////////////
+
+bool TablePrint::reserve(size_t extra)
+{
+  if (PrintFormat::growBuffer(buf, cap, len + extra)) return true;
+  write_error = 1;
+  broken = true;
+  return false;
+}
+
+void TablePrint::append(const char *s, size_t n)
+{
+  if (!reserve(n)) return;
+  memcpy(buf + len, s, n);
+  len += n;
+}
+
+size_t TablePrint::flush()
+{
+  // only complete rows, the current one stays
+  if (row_start == 0) return 0;
+  size_t n = output.write((const uint8_t *)buf, row_start);
+  if (n < row_start) write_error = 1;
+  memmove(buf, buf + row_start, len - row_start);
+  len -= row_start;
+  row_start = 0;
+  return n;
+}
+
+// Cells ///////////////////////////////////////////////////////////////////////
+
+// adds the separator, false if the row is full
+bool TablePrint::beginCell()
+{
+  if (cells == column_count) {
+    write_error = TABLE_PRINT_MISUSE;
+    return false;
+  }
+  if (cells++ > 0) append(&separator, 1);
+  return true;
+}
+
+TablePrint &TablePrint::cell(const StringView &str)
+{
+  if (!beginCell()) return *this;
+  const char *s = str.data();
+  size_t n = str.length();
+  const char special[4] = {separator, '"', '\r', '\n'};
+  if (!StringKernels::findAnyByte(s, n, special, sizeof(special))) {
+    append(s, n);
+    return *this;
+  }
+  // quoted, with every '"' doubled
+  if (!reserve(n + 2 + StringKernels::countByte(s, n, '"'))) return *this;
+  append("\"", 1);
+  const char *quote;
+  while ((quote = StringKernels::findByte(s, n, '"')) != NULL) {
+    size_t run = (size_t)(quote - s) + 1;
+    append(s, run);
+    append("\"", 1);
+    s += run;
+    n -= run;
+  }
+  append(s, n);
+  append("\"", 1);
+  return *this;
+}
+
+TablePrint &TablePrint::cell(unsigned long n)
+{
+  char number[PrintFormat::NUMBER_SIZE];
+  char *end = number + sizeof(number);
+  char *str = PrintFormat::formatNumber(end, n, DEC);
+  if (beginCell()) append(str, (size_t)(end - str));
+  return *this;
+}
+
+TablePrint &TablePrint::cell(long n)
+{
+  if (n >= 0) return cell((unsigned long)n);
+  char number[PrintFormat::NUMBER_SIZE];
+  char *end = number + sizeof(number);
+  char *str = PrintFormat::formatNumber(end, 0UL - (unsigned long)n, DEC);
+  *--str = '-';
+  if (beginCell()) append(str, (size_t)(end - str));
+  return *this;
+}
+
+TablePrint &TablePrint::cell(double n, int digits)
+{
+  char number[64];
+  size_t size = PrintFormat::formatDouble(number, n, digits);
+  if (beginCell()) append(number, size);
+  return *this;
+}
+
+TablePrint &TablePrint::endRow()
+{
+  if (cells < column_count) {
+    write_error = TABLE_PRINT_MISUSE;
+    while (cells < column_count) beginCell();
+  }
+  append("\r\n", 2);
+  cells = 0;
+  if (broken) {
+    // an allocation failed, the row is incomplete: drop it
+    broken = false;
+    len = row_start;
+    return *this;
+  }
+  row_start = len;
+  if (row_start >= block_size) flush();
+  return *this;
+}
+
+TablePrint &TablePrint::printHeader()
+{
+  for (size_t i = 0; i < column_count; i++) {
+    if (names) cell(names[i]); else emptyCell();
+  }
+  return endRow();
+}
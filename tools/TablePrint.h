@@ -0,0 +1,127 @@
+/*
+  TablePrint.h - CSV / TSV table writer on top of any Print: typed cells,
+  RFC 4180 quoting when needed, whole rows written at once.
+
+  Copyright (c) 2021 Jorge Rivera. All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 3 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this library; if not, write to the Free Software Foundation,
+  Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef TablePrint_h
+#define TablePrint_h
+
+#include "Print.h"
+
+// Writes rows of a fixed number of columns to a Print:
+//
+//     const char *columns[] = {"name", "count", "ratio"};
+//     TablePrint table(Serial, columns, 3);
+//     table.printHeader();
+//     table.row(name, count, TableDouble(ratio, 3));
+//     // or cell by cell
+//     table.cell(name).cell(count).cell(ratio, 3).endRow();
+//
+// Cells holding the separator, '"', '\r' or '\n' are quoted as RFC 4180
+// asks, with '"' doubled; the others are copied as they are.  Rows end
+// with "\r\n" and are rendered into one buffer, written with a single
+// write() per row, or per block of rows with setBlockSize().
+//
+// A row with too many cells keeps the first ones, a row with too few is
+// completed with empty cells; both set getWriteError() to
+// TABLE_PRINT_MISUSE.  A failed write or allocation sets it to 1.
+class TablePrint
+{
+  public:
+    enum { TABLE_PRINT_MISUSE = 2 };
+
+    // columns names are copied, separator ',' for CSV or '\t' for TSV
+    TablePrint(Print &output, const char *const *columns, size_t count, char separator = ',');
+    // unnamed columns
+    TablePrint(Print &output, size_t count, char separator = ',');
+    // writes the pending rows
+    ~TablePrint();
+
+    int getWriteError() { return write_error; }
+    void clearWriteError() { write_error = 0; }
+
+    size_t columns() const { return column_count; }
+    // keeps rows in the buffer until it holds size bytes, 0 (the
+    // default) writes every row as soon as it ends
+    void setBlockSize(size_t size) { block_size = size; }
+    // writes the pending rows, returns the bytes written
+    size_t flush();
+
+    // row of the column names
+    TablePrint &printHeader();
+
+    TablePrint &cell(const char *str) { return cell(StringView(str)); }
+    TablePrint &cell(const String &str) { return cell(str.view()); }
+    TablePrint &cell(const StringView &str);
+    TablePrint &cell(char c) { return cell(StringView(&c, 1)); }
+    TablePrint &cell(unsigned char n) { return cell((unsigned long)n); }
+    TablePrint &cell(int n) { return cell((long)n); }
+    TablePrint &cell(unsigned int n) { return cell((unsigned long)n); }
+    TablePrint &cell(long n);
+    TablePrint &cell(unsigned long n);
+    TablePrint &cell(double n, int digits = 2);
+    TablePrint &emptyCell() { return cell(StringView()); }
+    TablePrint &endRow();
+
+    // a whole row at once, with the cell() types or TableDouble
+    template <class... T>
+    TablePrint &row(const T &... cells) {
+      // expands to one cell() per argument, in order
+      int expand[] = {0, (addCell(cells), 0)...};
+      (void)expand;
+      return endRow();
+    }
+
+  private:
+    Print &output;
+    char separator;
+    String *names;
+    size_t column_count;
+    size_t cells;          // cells in the current row
+    int write_error;
+
+    // rendered rows not written yet
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t row_start;      // start of the current row in buf
+    size_t block_size;
+    bool broken;           // an allocation failed, the row is incomplete
+
+    bool reserve(size_t extra);
+    void append(const char *s, size_t n);
+    bool beginCell();
+
+    template <class T> void addCell(const T &c) { cell(c); }
+
+    TablePrint(const TablePrint &);
+    TablePrint &operator = (const TablePrint &);
+};
+
+// A double with its number of decimals, for TablePrint::row()
+struct TableDouble
+{
+  double value;
+  int digits;
+  TableDouble(double v, int d = 2) : value(v), digits(d) {}
+};
+
+template <> inline void TablePrint::addCell(const TableDouble &c) { cell(c.value, c.digits); }
+
+#endif
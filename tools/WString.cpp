@@ -31,18 +31,18 @@
 */
 
 #include "WString.h"
+#include "StringAllocator.h"
+#include "StringKernels.h"
 #include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+
+// Buffer growth counters, see String::growthStats()
+static std::atomic<size_t> growth_reallocs(0);
+static std::atomic<size_t> growth_bytes_moved(0);
 
 
-// following the C++ standard operators with attributes in right
-// side must be defined globally
-String operator + ( const char *cstr, const String &str_arg) 
-{
-    String &str_arg_o = const_cast<String&>(str_arg);
-    String aux = String(cstr);
-    aux.concat(str_arg_o);  
-    return aux;
-}
 /*********************************************/
 /*  Constructors                             */
 /*********************************************/
@@ -50,7 +50,7 @@ String operator + ( const char *cstr, const String &str_arg)
 String::String(const char *cstr)
 {
 	init();
-	if (cstr) copy(cstr, (unsigned int)strlen(cstr));
+	if (cstr) copy(cstr, strlen(cstr));
 }
 
 String::String(const String &value)
@@ -59,18 +59,23 @@ String::String(const String &value)
 	*this = value;
 }
 
-#ifdef __GXX_EXPERIMENTAL_CXX0X__
-String::String(String &&rval)
+String::String(const StringView &view)
+{
+	init();
+	copy(view.data(), view.length());
+}
+
+String::String(String &&rval) noexcept
 {
 	init();
 	move(rval);
 }
-String::String(StringSumHelper &&rval)
+
+String::String(StringSumHelper &&rval) noexcept
 {
 	init();
 	move(rval);
 }
-#endif
 
 String::String(char c)
 {
@@ -172,113 +177,285 @@ String::String(unsigned long value, unsigned char base)
 
 String::~String()
 {
-	free(buffer);
+	if (buffer && !isInline()) releaseHeap(buffer);
 }
 
 /*********************************************/
 /*  Memory Management                        */
 /*********************************************/
 
-inline void String::init(void)
+// Heap buffers are preceded by a small header holding the number of
+// String objects sharing them.  Copies share the buffer and only the
+// first mutation duplicates it (copy-on-write), see String::unshare().
+// The header also keeps the allocator and the size of the block, so it
+// is always resized and freed by the allocator it came from, and the
+// cached hash and UTF-8 class of the contents.  Once operator[] has handed
+// out a char& into a buffer, the buffer is never shared again: later copies
+// are deep, so writes through the reference can't reach them.
+struct StringHeap
+{
+	std::atomic<unsigned int> refs;
+	unsigned char interned;        // owned by the intern table, immutable
+	unsigned char unshareable;     // a char& into the buffer may be alive
+	std::atomic<unsigned char> text; // TEXT_* flags, 0 until computed
+	StringAllocator *allocator;
+	size_t size;                   // block size, header included
+	std::atomic<uint64_t> hash;    // 0 until computed
+};
+
+// keep the characters that follow the header pointer aligned
+static const size_t heap_header_size = (sizeof(StringHeap) + 15) & ~(size_t)15;
+
+static inline StringHeap *heapOf(const char *buffer)
 {
-	buffer = NULL;
-	capacity = 0;
-	len = 0;
-	flags = 0;
+	return (StringHeap *)(void *)(const_cast<char *>(buffer) - heap_header_size);
+}
+
+// allocate an unshared heap buffer for maxStrLen characters plus the '\0',
+// of which minStrLen are needed now (for the allocator accounting)
+static char *allocHeap(StringAllocator &allocator, size_t maxStrLen, size_t minStrLen)
+{
+	size_t size = heap_header_size + maxStrLen + 1;
+	void *block = allocator.allocateFor(size, heap_header_size + minStrLen + 1);
+	if (!block) return NULL;
+	StringHeap *heap = new (block) StringHeap;
+	heap->refs.store(1, std::memory_order_relaxed);
+	heap->interned = 0;
+	heap->unshareable = 0;
+	heap->allocator = &allocator;
+	heap->size = size;
+	heap->hash.store(0, std::memory_order_relaxed);
+	heap->text.store(0, std::memory_order_relaxed);
+	return (char *)block + heap_header_size;
+}
+
+// resize an unshared heap buffer, which may move
+static char *reallocHeap(char *buffer, size_t maxStrLen, size_t minStrLen)
+{
+	StringHeap *heap = heapOf(buffer);
+	size_t size = heap_header_size + maxStrLen + 1;
+	void *block = heap->allocator->reallocateFor(heap, heap->size, size, heap_header_size + minStrLen + 1);
+	if (!block) return NULL;
+	((StringHeap *)block)->size = size;
+	return (char *)block + heap_header_size;
+}
+
+void String::releaseHeap(char *heapbuffer)
+{
+	StringHeap *heap = heapOf(heapbuffer);
+	if (heap->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		StringAllocator *allocator = heap->allocator;
+		size_t size = heap->size;
+		heap->~StringHeap();
+		allocator->deallocate(heap, size);
+	}
+}
+
+StringAllocator &String::allocator(void) const
+{
+	if (buffer && !isInline()) return *heapOf(buffer)->allocator;
+	return StringAllocator::current();
 }
 
 void String::invalidate(void)
 {
-	if (buffer) free(buffer);
+	if (buffer && !isInline()) releaseHeap(buffer);
 	buffer = NULL;
 	capacity = len = 0;
 }
 
-unsigned char String::reserve(unsigned int size)
+bool String::isShared(void) const
 {
-	if (buffer && capacity >= size) return 1;
-	if (changeBuffer(size)) {
+	if (!buffer || isInline()) return false;
+	return heapOf(buffer)->refs.load(std::memory_order_acquire) > 1;
+}
+
+unsigned char String::unshare(void)
+{
+	if (isShared() && !changeBuffer(len)) return 0;
+	// the caller is about to write to the buffer
+	modified();
+	return 1;
+}
+
+void String::forgetHash(char *heapbuffer)
+{
+	heapOf(heapbuffer)->hash.store(0, std::memory_order_relaxed);
+	heapOf(heapbuffer)->text.store(0, std::memory_order_relaxed);
+}
+
+unsigned char String::reserve(size_t size)
+{
+	if (buffer && capacity >= size && !isShared()) return 1;
+	if (changeBuffer(size > len ? size : len)) {
 		if (len == 0) buffer[0] = 0;
 		return 1;
 	}
 	return 0;
 }
 
-unsigned char String::changeBuffer(unsigned int maxStrLen)
+void String::clear(void)
+{
+	if (isShared()) invalidate();
+	if (!buffer && !reserve(0)) return;
+	len = 0;
+	buffer[0] = 0;
+	modified();
+}
+
+unsigned char String::shrinkToFit(void)
+{
+	if (!buffer || isInline() || isShared() || capacity == len) return 1;
+	if (len <= STRING_SSO_CAPACITY) {
+		memcpy(sso, buffer, len + 1);
+		releaseHeap(buffer);
+		buffer = sso;
+		capacity = STRING_SSO_CAPACITY;
+		return 1;
+	}
+	return changeBuffer(len);
+}
+
+StringGrowthStats String::growthStats(void)
+{
+	StringGrowthStats stats;
+	stats.reallocs = growth_reallocs.load(std::memory_order_relaxed);
+	stats.bytesMoved = growth_bytes_moved.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void String::resetGrowthStats(void)
+{
+	growth_reallocs.store(0, std::memory_order_relaxed);
+	growth_bytes_moved.store(0, std::memory_order_relaxed);
+}
+
+// grow the buffer geometrically (by 1.5x) so that a sequence of appends
+// costs amortized O(1) reallocations per append instead of one each
+unsigned char String::growBuffer(size_t minStrLen)
+{
+	size_t newcap = capacity + (capacity >> 1);
+	if (newcap < minStrLen) newcap = minStrLen;
+	if (changeBuffer(newcap, minStrLen)) return 1;
+	// fall back to the exact size if the larger block is not available
+	return newcap > minStrLen && changeBuffer(minStrLen);
+}
+
+// moves the contents to a buffer of maxStrLen (>= len) characters that
+// this String owns exclusively, minStrLen of them needed right away
+unsigned char String::changeBuffer(size_t maxStrLen, size_t minStrLen)
 {
-	char *newbuffer = (char *)realloc(buffer, maxStrLen + 1);
-	if (newbuffer) {
+	bool onHeap = buffer && !isInline();
+	bool shared = onHeap && isShared();
+	if (onHeap && !shared) {
+		char *newbuffer = reallocHeap(buffer, maxStrLen, minStrLen);
+		if (!newbuffer) return 0;
+		growth_reallocs.fetch_add(1, std::memory_order_relaxed);
+		if (newbuffer != buffer) {
+			growth_bytes_moved.fetch_add(len + 1, std::memory_order_relaxed);
+		}
 		buffer = newbuffer;
 		capacity = maxStrLen;
 		return 1;
 	}
-	return 0;
+	if (maxStrLen <= STRING_SSO_CAPACITY) {
+		// short contents fit in the inline storage, no allocation needed
+		if (shared) {
+			memcpy(sso, buffer, len + 1);
+			releaseHeap(buffer);
+		}
+		buffer = sso;
+		capacity = STRING_SSO_CAPACITY;
+		return 1;
+	}
+	// grow out of the inline storage, or out of a shared buffer
+	char *newbuffer = allocHeap(allocator(), maxStrLen, minStrLen);
+	if (!newbuffer) return 0;
+	growth_reallocs.fetch_add(1, std::memory_order_relaxed);
+	if (buffer) {
+		memcpy(newbuffer, buffer, len + 1);
+		growth_bytes_moved.fetch_add(len + 1, std::memory_order_relaxed);
+	}
+	if (shared) releaseHeap(buffer);
+	buffer = newbuffer;
+	capacity = maxStrLen;
+	return 1;
 }
 
 /*********************************************/
 /*  Copy and Move                            */
 /*********************************************/
 
-String & String::copy(const char *cstr, unsigned int _length)
+String & String::copy(const char *cstr, size_t _length)
 {
+	// the old contents are overwritten, don't duplicate a shared buffer
+	if (isShared()) invalidate();
 	if (!reserve(_length)) {
 		invalidate();
 		return *this;
 	}
 	len = _length;
-	strcpy(buffer, cstr);
+	memmove(buffer, cstr, _length);
+	buffer[_length] = 0;
+	modified();
 	return *this;
 }
 
-#ifdef __GXX_EXPERIMENTAL_CXX0X__
-void String::move(String &rhs)
+// O(1): a heap buffer changes hands with the allocator recorded in its
+// header, whatever allocator is current, inline contents are at most
+// STRING_SSO_CAPACITY characters.
+void String::move(String &rhs) noexcept
 {
-	if (buffer) {
-		if (capacity >= rhs.len) {
-			strcpy(buffer, rhs.buffer);
-			len = rhs.len;
-			rhs.len = 0;
-			return;
-		} else {
-			free(buffer);
-		}
+	if (buffer && !isInline()) releaseHeap(buffer);
+	if (rhs.isInline()) {
+		memcpy(sso, rhs.sso, rhs.len + 1);
+		buffer = sso;
+		capacity = STRING_SSO_CAPACITY;
+		len = rhs.len;
+		rhs.len = 0;
+		rhs.sso[0] = 0;
+		return;
 	}
 	buffer = rhs.buffer;
 	capacity = rhs.capacity;
 	len = rhs.len;
-	rhs.buffer = NULL;
-	rhs.capacity = 0;
-	rhs.len = 0;
+	rhs.init();
 }
-#endif
 
 String & String::operator = (const String &rhs)
 {
-	if (this == &rhs) return *this;
+	if (this == &rhs || buffer == rhs.buffer) return *this;
 
-	if (rhs.buffer) copy(rhs.buffer, rhs.len);
+	if (rhs.buffer && !rhs.isInline() && !heapOf(rhs.buffer)->unshareable &&
+	    heapOf(rhs.buffer)->allocator == &allocator()) {
+		// share the heap buffer, it is duplicated on the first mutation
+		heapOf(rhs.buffer)->refs.fetch_add(1, std::memory_order_relaxed);
+		if (buffer && !isInline()) releaseHeap(buffer);
+		buffer = rhs.buffer;
+		capacity = rhs.capacity;
+		len = rhs.len;
+	}
+	else if (rhs.buffer) copy(rhs.buffer, rhs.len);
 	else invalidate();
 
 	return *this;
 }
 
-#ifdef __GXX_EXPERIMENTAL_CXX0X__
-String & String::operator = (String &&rval)
+String & String::operator = (String &&rval) noexcept
 {
 	if (this != &rval) move(rval);
 	return *this;
 }
 
-String & String::operator = (StringSumHelper &&rval)
+String & String::operator = (StringSumHelper &&rval) noexcept
 {
 	if (this != &rval) move(rval);
 	return *this;
 }
-#endif
 
 String & String::operator = (const char *cstr)
 {
-	if (cstr) copy(cstr, (unsigned int)strlen(cstr));
+	if (cstr) copy(cstr, strlen(cstr));
 	else invalidate();
 
 	return *this;
@@ -293,21 +470,32 @@ unsigned char String::concat(const String &s)
 	return concat(s.buffer, s.len);
 }
 
-unsigned char String::concat(const char *cstr, unsigned int _length)
+unsigned char String::concat(const char *cstr, size_t _length)
 {
-	unsigned int newlen = len + _length;
+	size_t newlen = len + _length;
 	if (!cstr) return 0;
 	if (_length == 0) return 1;
-	if (!reserve(newlen)) return 0;
-	strcpy(buffer + len, cstr);
+	if (!buffer || newlen > capacity || isShared()) {
+		// cstr may point into our own buffer (s += s), which can move
+		if (buffer && cstr >= buffer && cstr <= buffer + len) {
+			size_t offset = (size_t)(cstr - buffer);
+			if (!growBuffer(newlen)) return 0;
+			cstr = buffer + offset;
+		} else if (!growBuffer(newlen)) {
+			return 0;
+		}
+	}
+	memcpy(buffer + len, cstr, _length);
 	len = newlen;
+	buffer[len] = 0;
+	modified();
 	return 1;
 }
 
 unsigned char String::concat(const char *cstr)
 {
 	if (!cstr) return 0;
-	return concat(cstr, (unsigned int)strlen(cstr));
+	return concat(cstr, strlen(cstr));
 }
 
 unsigned char String::concat(char c)
@@ -320,102 +508,32 @@ unsigned char String::concat(char c)
 
 unsigned char String::concat(unsigned char num)
 {
-	char buf[4];
-	//itoa(num, buf, 10);
-	snprintf(buf, sizeof(buf), getCSpec(10, true, false), num);
-	return concat(buf, (unsigned int)strlen(buf));
+	StringNumber n(num);
+	return concat(n.c_str(), n.length());
 }
 
 unsigned char String::concat(int num)
 {
-	char buf[7];
-	//itoa(num, buf, 10);
-	snprintf(buf, sizeof(buf), getCSpec(10, true, false), num);
-	return concat(buf, (unsigned int)strlen(buf));
+	StringNumber n(num);
+	return concat(n.c_str(), n.length());
 }
 
 unsigned char String::concat(unsigned int num)
 {
-	char buf[6];
-	//utoa(num, buf, 10);
-	snprintf(buf, sizeof(buf), getCSpec(10, false, false), num);
-	return concat(buf, (unsigned int)strlen(buf));
+	StringNumber n(num);
+	return concat(n.c_str(), n.length());
 }
 
 unsigned char String::concat(long num)
 {
-	char buf[12];
-	//ltoa(num, buf, 10);
-	snprintf(buf, sizeof(buf), getCSpec(10, true, true), num);
-	return concat(buf, (unsigned int)strlen(buf));
+	StringNumber n(num);
+	return concat(n.c_str(), n.length());
 }
 
 unsigned char String::concat(unsigned long num)
 {
-	char buf[11];
-	//ultoa(num, buf, 10);
-	snprintf(buf, sizeof(buf), getCSpec(10, false, true), num);
-	return concat(buf, (unsigned int)strlen(buf));
-}
-
-/*********************************************/
-/*  Concatenate                              */
-/*********************************************/
-
-StringSumHelper & operator + (const StringSumHelper &lhs, const String &rhs)
-{
-	StringSumHelper &a = const_cast<StringSumHelper&>(lhs);
-	if (!a.concat(rhs.buffer, rhs.len)) a.invalidate();
-	return a;
-}
-
-StringSumHelper & operator + (const StringSumHelper &lhs, const char *cstr)
-{
-	StringSumHelper &a = const_cast<StringSumHelper&>(lhs);
-	if (!cstr || !a.concat(cstr, (unsigned int)strlen(cstr))) a.invalidate();
-	return a;
-}
-
-StringSumHelper & operator + (const StringSumHelper &lhs, char c)
-{
-	StringSumHelper &a = const_cast<StringSumHelper&>(lhs);
-	if (!a.concat(c)) a.invalidate();
-	return a;
-}
-
-StringSumHelper & operator + (const StringSumHelper &lhs, unsigned char num)
-{
-	StringSumHelper &a = const_cast<StringSumHelper&>(lhs);
-	if (!a.concat(num)) a.invalidate();
-	return a;
-}
-
-StringSumHelper & operator + (const StringSumHelper &lhs, int num)
-{
-	StringSumHelper &a = const_cast<StringSumHelper&>(lhs);
-	if (!a.concat(num)) a.invalidate();
-	return a;
-}
-
-StringSumHelper & operator + (const StringSumHelper &lhs, unsigned int num)
-{
-	StringSumHelper &a = const_cast<StringSumHelper&>(lhs);
-	if (!a.concat(num)) a.invalidate();
-	return a;
-}
-
-StringSumHelper & operator + (const StringSumHelper &lhs, long num)
-{
-	StringSumHelper &a = const_cast<StringSumHelper&>(lhs);
-	if (!a.concat(num)) a.invalidate();
-	return a;
-}
-
-StringSumHelper & operator + (const StringSumHelper &lhs, unsigned long num)
-{
-	StringSumHelper &a = const_cast<StringSumHelper&>(lhs);
-	if (!a.concat(num)) a.invalidate();
-	return a;
+	StringNumber n(num);
+	return concat(n.c_str(), n.length());
 }
 
 /*********************************************/
@@ -429,19 +547,26 @@ int String::compareTo(const String &s) const
 		if (buffer && len > 0) return *(unsigned char *)buffer;
 		return 0;
 	}
-	return strcmp(buffer, s.buffer);
+	size_t n = len < s.len ? len : s.len;
+	int diff = n ? memcmp(buffer, s.buffer, n) : 0;
+	if (diff != 0 || len == s.len) return diff;
+	return len < s.len ? 0 - ((unsigned char *)s.buffer)[n] : ((unsigned char *)buffer)[n];
 }
 
 unsigned char String::equals(const String &s2) const
 {
-	return (len == s2.len && compareTo(s2) == 0);
+	if (len != s2.len) return 0;
+	if (len == 0 || buffer == s2.buffer) return 1;
+	// there is one copy of each interned contents
+	if (isInterned() && s2.isInterned()) return 0;
+	return memcmp(buffer, s2.buffer, len) == 0;
 }
 
 unsigned char String::equals(const char *cstr) const
 {
 	if (len == 0) return (cstr == NULL || *cstr == 0);
-	if (cstr == NULL) return buffer[0] == 0;
-	return strcmp(buffer, cstr) == 0;
+	if (cstr == NULL) return 0;
+	return strlen(cstr) == len && memcmp(buffer, cstr, len) == 0;
 }
 
 unsigned char String::operator<(const String &rhs) const
@@ -468,13 +593,8 @@ unsigned char String::equalsIgnoreCase( const String &s2 ) const
 {
 	if (this == &s2) return 1;
 	if (len != s2.len) return 0;
-	if (len == 0) return 1;
-	const char *p1 = buffer;
-	const char *p2 = s2.buffer;
-	while (*p1) {
-		if (tolower(*p1++) != tolower(*p2++)) return 0;
-	}
-	return 1;
+	if (len == 0 || buffer == s2.buffer) return 1;
+	return StringKernels::equalsIgnoreCaseAscii(buffer, s2.buffer, len);
 }
 
 unsigned char String::startsWith( const String &s2 ) const
@@ -483,58 +603,162 @@ unsigned char String::startsWith( const String &s2 ) const
 	return startsWith(s2, 0);
 }
 
-unsigned char String::startsWith( const String &s2, unsigned int offset ) const
+unsigned char String::startsWith( const String &s2, size_t offset ) const
 {
-	if (offset > len - s2.len || !buffer || !s2.buffer) return 0;
-	return strncmp( &buffer[offset], s2.buffer, s2.len ) == 0;
+	if (s2.len > len || offset > len - s2.len || !buffer || !s2.buffer) return 0;
+	return memcmp( &buffer[offset], s2.buffer, s2.len ) == 0;
 }
 
 unsigned char String::endsWith( const String &s2 ) const
 {
 	if ( len < s2.len || !buffer || !s2.buffer) return 0;
-	return strcmp(&buffer[len - s2.len], s2.buffer) == 0;
+	return memcmp(&buffer[len - s2.len], s2.buffer, s2.len) == 0;
+}
+
+/*********************************************/
+/*  Hashing and Interning                    */
+/*********************************************/
+
+uint64_t String::hash(void) const
+{
+	if (!buffer || isInline()) return StringKernels::hashBytes(buffer, len);
+	StringHeap *heap = heapOf(buffer);
+	// writes through a char& from operator[] don't call modified()
+	if (heap->unshareable) return StringKernels::hashBytes(buffer, len);
+	uint64_t h = heap->hash.load(std::memory_order_relaxed);
+	if (!h) {
+		// racing threads store the same value
+		h = StringKernels::hashBytes(buffer, len);
+		heap->hash.store(h, std::memory_order_relaxed);
+	}
+	return h;
+}
+
+bool String::isInterned(void) const
+{
+	return buffer && !isInline() && heapOf(buffer)->interned;
+}
+
+// Open addressing table of the interned buffers, each holding one
+// reference so they are never freed.  Lookups take the lock, intern keys
+// once and keep the interned String.
+struct InternEntry
+{
+	uint64_t hash;
+	char *buffer;
+	size_t len;
+};
+
+static std::mutex intern_lock;
+static InternEntry *intern_table = NULL;
+static size_t intern_size = 0;     // slots, a power of two
+static size_t intern_count = 0;
+
+static bool internGrow(void)
+{
+	size_t newsize = intern_size ? intern_size * 2 : 256;
+	InternEntry *table = (InternEntry *)calloc(newsize, sizeof(InternEntry));
+	if (!table) return false;
+	for (size_t i = 0; i < intern_size; i++) {
+		if (!intern_table[i].buffer) continue;
+		size_t slot = (size_t)intern_table[i].hash & (newsize - 1);
+		while (table[slot].buffer) slot = (slot + 1) & (newsize - 1);
+		table[slot] = intern_table[i];
+	}
+	free(intern_table);
+	intern_table = table;
+	intern_size = newsize;
+	return true;
+}
+
+String String::intern(void) const
+{
+	String result;
+	if (!buffer) {
+		result.invalidate();
+		return result;
+	}
+	if (isInterned()) {
+		result.buffer = buffer;
+	} else {
+		uint64_t h = hash();
+		std::lock_guard<std::mutex> lock(intern_lock);
+		if ((intern_count + 1) * 2 > intern_size && !internGrow()) return *this;
+		size_t slot = (size_t)h & (intern_size - 1);
+		for (; intern_table[slot].buffer; slot = (slot + 1) & (intern_size - 1)) {
+			const InternEntry &e = intern_table[slot];
+			if (e.hash == h && e.len == len && memcmp(e.buffer, buffer, len) == 0) break;
+		}
+		if (!intern_table[slot].buffer) {
+			// interned buffers don't belong to any scoped allocator
+			char *copy = allocHeap(StringAllocator::heap(), len, len);
+			if (!copy) return *this;
+			memcpy(copy, buffer, len + 1);
+			heapOf(copy)->interned = 1;
+			heapOf(copy)->hash.store(h, std::memory_order_relaxed);
+			intern_table[slot].hash = h;
+			intern_table[slot].buffer = copy;
+			intern_table[slot].len = len;
+			intern_count++;
+		}
+		result.buffer = intern_table[slot].buffer;
+	}
+	// share the interned buffer directly, whatever the current allocator
+	heapOf(result.buffer)->refs.fetch_add(1, std::memory_order_relaxed);
+	result.capacity = len;
+	result.len = len;
+	return result;
+}
+
+size_t String::internedCount(void)
+{
+	std::lock_guard<std::mutex> lock(intern_lock);
+	return intern_count;
 }
 
 /*********************************************/
 /*  Character Access                         */
 /*********************************************/
 
-char String::charAt(unsigned int loc) const
+char String::charAt(size_t loc) const
 {
 	return operator[](loc);
 }
 
-void String::setCharAt(unsigned int loc, char c)
+void String::setCharAt(size_t loc, char c)
 {
-	if (loc < len) buffer[loc] = c;
+	if (loc < len && unshare()) buffer[loc] = c;
 }
 
-char & String::operator[](unsigned int index)
+char & String::operator[](size_t index)
 {
 	static char dummy_writable_char;
-	if (index >= len || !buffer) {
+	// the reference may be written through, so a shared buffer is duplicated
+	// and this one stays private to this String for as long as it lives
+	if (index >= len || !buffer || !unshare()) {
 		dummy_writable_char = 0;
 		return dummy_writable_char;
 	}
+	if (!isInline()) heapOf(buffer)->unshareable = 1;
 	return buffer[index];
 }
 
-char String::operator[]( unsigned int index ) const
+char String::operator[]( size_t index ) const
 {
 	if (index >= len || !buffer) return 0;
 	return buffer[index];
 }
 
-void String::getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index) const
+void String::getBytes(unsigned char *buf, size_t bufsize, size_t index) const
 {
 	if (!bufsize || !buf) return;
 	if (index >= len) {
 		buf[0] = 0;
 		return;
 	}
-	unsigned int n = bufsize - 1;
+	size_t n = bufsize - 1;
 	if (n > len - index) n = len - index;
-	strncpy((char *)buf, buffer + index, n);
+	memcpy(buf, buffer + index, n);
 	buf[n] = 0;
 }
 
@@ -542,83 +766,191 @@ void String::getBytes(unsigned char *buf, unsigned int bufsize, unsigned int ind
 /*  Search                                   */
 /*********************************************/
 
-int String::indexOf(char c) const
+long String::indexOf(char c) const
 {
 	return indexOf(c, 0);
 }
 
-int String::indexOf( char ch, unsigned int fromIndex ) const
+long String::indexOf( char ch, size_t fromIndex ) const
 {
 	if (fromIndex >= len) return -1;
-	const char* temp = strchr(buffer + fromIndex, ch);
+	const char* temp = StringKernels::findByte(buffer + fromIndex, len - fromIndex, ch);
 	if (temp == NULL) return -1;
-	return (int)(temp - buffer);
+	return (long)(temp - buffer);
 }
 
-int String::indexOf(const String &s2) const
+long String::indexOf(const String &s2) const
 {
 	return indexOf(s2, 0);
 }
 
-int String::indexOf(const String &s2, unsigned int fromIndex) const
+long String::indexOf(const String &s2, size_t fromIndex) const
 {
-	if (fromIndex >= len) return -1;
-	const char *found = strstr(buffer + fromIndex, s2.buffer);
+	if (fromIndex >= len || !s2.buffer) return -1;
+	const char *found = StringKernels::findBytes(buffer + fromIndex, len - fromIndex, s2.buffer, s2.len);
 	if (found == NULL) return -1;
-	return (int)(found - buffer);
+	return (long)(found - buffer);
 }
 
-int String::lastIndexOf( char theChar ) const
+long String::indexOfAny(const String &set) const
+{
+	return indexOfAny(set, 0);
+}
+
+long String::indexOfAny(const String &set, size_t fromIndex) const
+{
+	if (fromIndex >= len || !set.buffer) return -1;
+	const char *found = StringKernels::findAnyByte(buffer + fromIndex, len - fromIndex, set.buffer, set.len);
+	if (found == NULL) return -1;
+	return (long)(found - buffer);
+}
+
+long String::lastIndexOf( char theChar ) const
 {
 	return lastIndexOf(theChar, len - 1);
 }
 
-int String::lastIndexOf(char ch, unsigned int fromIndex) const
+long String::lastIndexOf(char ch, size_t fromIndex) const
 {
 	if (fromIndex >= len) return -1;
-	char tempchar = buffer[fromIndex + 1];
-	buffer[fromIndex + 1] = '\0';
-	char* temp = strrchr( buffer, ch );
-	buffer[fromIndex + 1] = tempchar;
+	const char *temp = StringKernels::findLastByte(buffer, fromIndex + 1, ch);
 	if (temp == NULL) return -1;
-	return (int)(temp - buffer);
+	return (long)(temp - buffer);
 }
 
-int String::lastIndexOf(const String &s2) const
+long String::lastIndexOf(const String &s2) const
 {
 	return lastIndexOf(s2, len - s2.len);
 }
 
-int String::lastIndexOf(const String &s2, unsigned int fromIndex) const
+long String::lastIndexOf(const String &s2, size_t fromIndex) const
 {
   	if (s2.len == 0 || len == 0 || s2.len > len) return -1;
 	if (fromIndex >= len) fromIndex = len - 1;
-	int found = -1;
-	for (char *p = buffer; p <= buffer + fromIndex; p++) {
-		p = strstr(p, s2.buffer);
-		if (!p) break;
-		if ((unsigned int)(p - buffer) <= fromIndex) found = (int)(p - buffer);
+	// matches start at fromIndex at the latest, but may extend past it
+	size_t end = fromIndex + s2.len;
+	if (end > len) end = len;
+	const char *found = StringKernels::findLastBytes(buffer, end, s2.buffer, s2.len);
+	if (found == NULL) return -1;
+	return (long)(found - buffer);
+}
+
+size_t String::count(char ch) const
+{
+	if (!buffer) return 0;
+	return StringKernels::countByte(buffer, len, ch);
+}
+
+size_t String::count(const String &str) const
+{
+	if (!buffer || !str.buffer || str.len == 0) return 0;
+	size_t n = 0;
+	const char *end = buffer + len;
+	const char *p = buffer;
+	while ((p = StringKernels::findBytes(p, (size_t)(end - p), str.buffer, str.len)) != NULL) {
+		n++;
+		p += str.len;
 	}
-	return found;
+	return n;
 }
 
-String String::substring(unsigned int left, unsigned int right) const
+String String::substring(size_t left, size_t right) const
 {
 	if (left > right) {
-		unsigned int temp = right;
+		size_t temp = right;
 		right = left;
 		left = temp;
 	}
 	String out;
-	if (left > len) return out;
+	if (left > len || !buffer) return out;
 	if (right > len) right = len;
-	char temp = buffer[right];  // save the replaced character
-	buffer[right] = '\0';
-	out = buffer + left;  // pointer arithmetic
-	buffer[right] = temp;  //restore character
+	out.copy(buffer + left, right - left);
 	return out;
 }
 
+/*********************************************/
+/*  UTF-8                                    */
+/*********************************************/
+
+enum {TEXT_CLASSIFIED = 1, TEXT_ASCII = 2, TEXT_UTF8 = 4};
+
+static unsigned char classifyText(const char *s, size_t n)
+{
+	size_t ascii = StringKernels::spanAscii(s, n);
+	if (ascii == n) return TEXT_CLASSIFIED | TEXT_ASCII | TEXT_UTF8;
+	if (StringKernels::spanUtf8(s + ascii, n - ascii) == n - ascii) return TEXT_CLASSIFIED | TEXT_UTF8;
+	return TEXT_CLASSIFIED;
+}
+
+// inline strings are short enough to scan every time, heap buffers keep
+// the answer in their header like the hash
+static unsigned char textOf(const String &s)
+{
+	if (!s.buffer || s.isInline()) return classifyText(s.buffer, s.len);
+	StringHeap *heap = heapOf(s.buffer);
+	// like hash(), not cached for buffers written through operator[]
+	if (heap->unshareable) return classifyText(s.buffer, s.len);
+	unsigned char c = heap->text.load(std::memory_order_relaxed);
+	if (!c) {
+		// racing threads store the same value
+		c = classifyText(s.buffer, s.len);
+		heap->text.store(c, std::memory_order_relaxed);
+	}
+	return c;
+}
+
+bool String::isAscii(void) const
+{
+	return (textOf(*this) & TEXT_ASCII) != 0;
+}
+
+bool String::isValidUtf8(void) const
+{
+	return (textOf(*this) & TEXT_UTF8) != 0;
+}
+
+size_t String::utf8Length(void) const
+{
+	if (isAscii()) return len;
+	return StringKernels::countCodePoints(buffer, len);
+}
+
+// byte offset of a code point index from the byte offset from, which
+// starts a character
+static size_t utf8Offset(const String &s, bool ascii, size_t from, size_t index)
+{
+	if (ascii) return index < s.len - from ? from + index : s.len;
+	return from + StringKernels::codePointOffset(s.buffer + from, s.len - from, index);
+}
+
+long String::utf8CharAt(size_t index) const
+{
+	size_t i = utf8Offset(*this, isAscii(), 0, index);
+	if (i >= len) return -1;
+	return StringKernels::codePointAt(buffer + i, len - i);
+}
+
+StringView String::utf8Subview(size_t left, size_t right) const
+{
+	if (left > right) {
+		size_t temp = right;
+		right = left;
+		left = temp;
+	}
+	if (!buffer) return StringView();
+	bool ascii = isAscii();
+	size_t begin = utf8Offset(*this, ascii, 0, left);
+	size_t end = utf8Offset(*this, ascii, begin, right - left);
+	return StringView(buffer + begin, end - begin);
+}
+
+void String::utf8Truncate(size_t maxBytes)
+{
+	if (!buffer || maxBytes >= len || !unshare()) return;
+	len = StringKernels::utf8Boundary(buffer, len, maxBytes);
+	buffer[len] = 0;
+}
+
 /*********************************************/
 /*  Modification                             */
 /*********************************************/
@@ -626,79 +958,237 @@ String String::substring(unsigned int left, unsigned int right) const
 void String::replace(char find, char _replace)
 {
 	if (!buffer) return;
-	for (char *p = buffer; *p; p++) {
-		if (*p == find) *p = _replace;
+	// the whole length, embedded '\0' included; nothing is duplicated
+	// when there is nothing to replace
+	const char *first = (const char *)memchr(buffer, find, len);
+	if (!first) return;
+	size_t from = (size_t)(first - buffer);
+	if (!unshare()) return;
+	for (size_t i = from; i < len; i++) {
+		if (buffer[i] == find) buffer[i] = _replace;
+	}
+}
+
+// Positions of the matches found by the replace engine, the first ones
+// are kept on the stack
+struct StringMatch
+{
+	size_t pos;
+	unsigned int which;   // index of the find/replace pair
+};
+
+class StringMatchList
+{
+public:
+	StringMatchList() : items(local), count(0), cap(sizeof(local) / sizeof(local[0])) {}
+	~StringMatchList() {if (items != local) free(items);}
+	bool add(size_t pos, unsigned int which) {
+		if (count == cap) {
+			size_t newcap = cap * 2;
+			StringMatch *newitems = (StringMatch *)malloc(newcap * sizeof(StringMatch));
+			if (!newitems) return false;
+			memcpy(newitems, items, count * sizeof(StringMatch));
+			if (items != local) free(items);
+			items = newitems;
+			cap = newcap;
+		}
+		items[count].pos = pos;
+		items[count].which = which;
+		count++;
+		return true;
 	}
+	StringMatch *items;
+	size_t count;
+private:
+	size_t cap;
+	StringMatch local[32];
+};
+
+// Rewrites the String with every match replaced.  The result length is
+// known up front, so the text is built by a single forward copy into
+// one new buffer, or in place when the buffer is owned and big enough.
+static void applyMatches(String &s, const StringMatchList &matches, const String *find, const String *_replace)
+{
+	size_t newlen = s.len;
+	bool shrinks = true;  // no replacement is longer than its find
+	bool grows = true;    // no replacement is shorter than its find
+	bool aliased = false;
+	for (size_t i = 0; i < matches.count; i++) {
+		unsigned int k = matches.items[i].which;
+		newlen = newlen - find[k].len + _replace[k].len;
+		if (_replace[k].len > find[k].len) shrinks = false;
+		if (_replace[k].len < find[k].len) grows = false;
+		if (_replace[k].buffer == s.buffer) aliased = true;
+	}
+	if (!aliased && !s.isShared() && newlen <= s.capacity && (shrinks || grows)) {
+		char *buffer = s.buffer;
+		if (shrinks && grows) {
+			for (size_t i = 0; i < matches.count; i++) {
+				const String &r = _replace[matches.items[i].which];
+				memcpy(buffer + matches.items[i].pos, r.buffer, r.len);
+			}
+		} else if (shrinks) {
+			// shrinking: compact forwards
+			char *writeTo = buffer;
+			size_t readFrom = 0;
+			for (size_t i = 0; i < matches.count; i++) {
+				const StringMatch &m = matches.items[i];
+				size_t n = m.pos - readFrom;
+				memmove(writeTo, buffer + readFrom, n);
+				writeTo += n;
+				memcpy(writeTo, _replace[m.which].buffer, _replace[m.which].len);
+				writeTo += _replace[m.which].len;
+				readFrom = m.pos + find[m.which].len;
+			}
+			memmove(writeTo, buffer + readFrom, s.len - readFrom);
+		} else {
+			// growing: expand backwards, each byte moves once
+			size_t readEnd = s.len;
+			size_t writeEnd = newlen;
+			for (size_t i = matches.count; i-- > 0; ) {
+				const StringMatch &m = matches.items[i];
+				size_t tail = m.pos + find[m.which].len;
+				size_t n = readEnd - tail;
+				writeEnd -= n;
+				memmove(buffer + writeEnd, buffer + tail, n);
+				writeEnd -= _replace[m.which].len;
+				memcpy(buffer + writeEnd, _replace[m.which].buffer, _replace[m.which].len);
+				readEnd = m.pos;
+			}
+		}
+		s.len = newlen;
+		buffer[newlen] = 0;
+		s.modified();
+		return;
+	}
+	// build the result in a new buffer of the same allocator and adopt it
+	String out;
+	{
+		StringAllocatorScope scope(s.allocator());
+		if (!out.reserve(newlen)) return; // XXX: tell user!
+	}
+	char *writeTo = out.buffer;
+	size_t readFrom = 0;
+	for (size_t i = 0; i < matches.count; i++) {
+		const StringMatch &m = matches.items[i];
+		size_t n = m.pos - readFrom;
+		memcpy(writeTo, s.buffer + readFrom, n);
+		writeTo += n;
+		memcpy(writeTo, _replace[m.which].buffer, _replace[m.which].len);
+		writeTo += _replace[m.which].len;
+		readFrom = m.pos + find[m.which].len;
+	}
+	memcpy(writeTo, s.buffer + readFrom, s.len - readFrom);
+	out.len = newlen;
+	out.buffer[newlen] = 0;
+	s.move(out);
 }
 
 void String::replace(const String& find, const String& _replace)
 {
-	if (len == 0 || find.len == 0) return;
-	int diff = (int)(_replace.len - find.len);
-	char *readFrom = buffer;
-	char *foundAt;
-	if (diff == 0) {
-		while ((foundAt = strstr(readFrom, find.buffer)) != NULL) {
-			memcpy(foundAt, _replace.buffer, _replace.len);
-			readFrom = foundAt + _replace.len;
+	if (len == 0 || find.len == 0 || !_replace.buffer) return;
+	StringMatchList matches;
+	const char *end = buffer + len;
+	const char *p = buffer;
+	while ((p = StringKernels::findBytes(p, (size_t)(end - p), find.buffer, find.len)) != NULL) {
+		if (!matches.add((size_t)(p - buffer), 0)) return;
+		p += find.len;
+	}
+	if (matches.count) applyMatches(*this, matches, &find, &_replace);
+}
+
+void String::replace(const String *find, const String *_replace, unsigned int count)
+{
+	if (len == 0 || !find || !_replace || count == 0) return;
+	if (count == 1) {
+		replace(find[0], _replace[0]);
+		return;
+	}
+	// the pairs that can match, grouped by the first byte of their find
+	// (pairs[start[c]] to pairs[start[c + 1]]), longest find first
+	size_t start[257];
+	memset(start, 0, sizeof(start));
+	for (unsigned int k = 0; k < count; k++) {
+		if (find[k].len == 0 || !_replace[k].buffer) continue;
+		start[(unsigned char)find[k].buffer[0] + 1]++;
+	}
+	char firsts[256];     // the first bytes, for findAnyByte()
+	size_t nfirsts = 0;
+	for (int c = 0; c < 256; c++) {
+		if (start[c + 1]) firsts[nfirsts++] = (char)c;
+		start[c + 1] += start[c];
+	}
+	if (nfirsts == 0) return;
+	unsigned int local[32];
+	unsigned int *pairs = local;
+	if (start[256] > sizeof(local) / sizeof(local[0])) {
+		pairs = (unsigned int *)malloc(start[256] * sizeof(unsigned int));
+		if (!pairs) return;
+	}
+	size_t next[256];
+	memcpy(next, start, sizeof(next));
+	for (unsigned int k = 0; k < count; k++) {
+		if (find[k].len == 0 || !_replace[k].buffer) continue;
+		size_t c = (unsigned char)find[k].buffer[0];
+		// insertion keeping the group sorted by length, stable
+		size_t j = next[c]++;
+		while (j > start[c] && find[pairs[j - 1]].len < find[k].len) {
+			pairs[j] = pairs[j - 1];
+			j--;
 		}
-	} else if (diff < 0) {
-		char *writeTo = buffer;
-		while ((foundAt = strstr(readFrom, find.buffer)) != NULL) {
-			unsigned int n = (unsigned int)(foundAt - readFrom);
-			memcpy(writeTo, readFrom, n);
-			writeTo += n;
-			memcpy(writeTo, _replace.buffer, _replace.len);
-			writeTo += _replace.len;
-			readFrom = foundAt + find.len;
-			len += diff;
+		pairs[j] = k;
+	}
+
+	StringMatchList matches;
+	size_t i = 0;
+	bool failed = false;
+	while (i < len) {
+		const char *at = StringKernels::findAnyByte(buffer + i, len - i, firsts, nfirsts);
+		if (!at) break;
+		i = (size_t)(at - buffer);
+		size_t c = (unsigned char)*at;
+		size_t j = start[c];
+		for (; j < start[c + 1]; j++) {
+			const String &f = find[pairs[j]];
+			if (f.len <= len - i && memcmp(at + 1, f.buffer + 1, f.len - 1) == 0) break;
 		}
-		strcpy(writeTo, readFrom);
-	} else {
-		unsigned int size = len; // compute size needed for result
-		while ((foundAt = strstr(readFrom, find.buffer)) != NULL) {
-			readFrom = foundAt + find.len;
-			size += diff;
+		if (j == start[c + 1]) {
+			i++;
+			continue;
 		}
-		if (size == len) return;
-		if (size > capacity && !changeBuffer(size)) return; // XXX: tell user!
-		int index = len - 1;
-		while (index >= 0 && (index = lastIndexOf(find, (unsigned int)index)) >= 0) {
-			readFrom = buffer + index + find.len;
-			memmove(readFrom + diff, readFrom, (size_t)(len - (readFrom - buffer)));
-			len += diff;
-			buffer[len] = 0;
-			memcpy(buffer + index, _replace.buffer, _replace.len);
-			index--;
+		if (!matches.add(i, pairs[j])) {
+			failed = true;
+			break;
 		}
+		i += find[pairs[j]].len;
 	}
+	if (pairs != local) free(pairs);
+	if (failed) return;
+	if (matches.count) applyMatches(*this, matches, find, _replace);
 }
 
 void String::toLowerCase(void)
 {
-	if (!buffer) return;
-	for (char *p = buffer; *p; p++) {
-		*p = (char)tolower(*p);
-	}
+	if (!buffer || !unshare()) return;
+	StringKernels::toLowerAscii(buffer, len);
 }
 
 void String::toUpperCase(void)
 {
-	if (!buffer) return;
-	for (char *p = buffer; *p; p++) {
-		*p = (char)toupper(*p);
-	}
+	if (!buffer || !unshare()) return;
+	StringKernels::toUpperAscii(buffer, len);
 }
 
 void String::trim(void)
 {
 	if (!buffer || len == 0) return;
-	char *begin = buffer;
-	while (isspace(*begin)) begin++;
-	char *end = buffer + len - 1;
-	while (isspace(*end) && end >= begin) end--;
-	len = (unsigned int)(end + 1 - begin);
-	if (begin > buffer) memcpy(buffer, begin, len);
+	size_t begin = StringKernels::spanSpace(buffer, len);
+	size_t end = len;
+	if (begin < len) end -= StringKernels::spanSpaceBack(buffer + begin, len - begin);
+	if (begin == 0 && end == len) return;
+	if (!unshare()) return;
+	len = end - begin;
+	if (begin > 0) memmove(buffer, buffer + begin, len);
 	buffer[len] = 0;
 }
 
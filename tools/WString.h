@@ -33,20 +33,46 @@
 #ifdef __cplusplus
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
 
+#include "StringAllocator.h"
+#include "StringView.h"
+
 // When compiling programs with this class, the following gcc parameters
 // dramatically increase performance and memory (RAM) efficiency, typically
 // with little or no increase in code size.
 //     -felide-constructors
-//     -std=c++0x
+// C++11 is required (move semantics).
+
+// Strings up to this many characters are stored inside the String object
+// itself (small string optimization), with no heap allocation at all.
+// Longer strings move transparently to a heap buffer.  The default keeps
+// a String at 40 bytes on 64 bit targets (three words and 16 inline
+// bytes); 22 makes it 48 bytes, 38 makes it 64 bytes, a cache line.
+#ifndef STRING_SSO_CAPACITY
+#define STRING_SSO_CAPACITY 15
+#endif
+
 
+// Process wide counters of String heap buffer growth, see
+// String::growthStats().
+struct StringGrowthStats
+{
+	size_t reallocs;     // heap buffer allocations and reallocations
+	size_t bytesMoved;   // bytes copied because a buffer had to move
+};
 
 // An inherited class for holding the result of a concatenation.  These
 // result objects are assumed to be writable by subsequent concatenations.
 class StringSumHelper;
 
+// Base of the lazy concatenation expressions built by "a + b + ...",
+// see the end of this file.
+template <class E> class StringExpr;
+
 // The string class
 class String
 {
@@ -64,10 +90,13 @@ public:
 	// be false).
 	String(const char *cstr = "");
 	String(const String &str);
-	#ifdef __GXX_EXPERIMENTAL_CXX0X__
-	String(String &&rval);
-	String(StringSumHelper &&rval);
-	#endif
+	template <class E> String(const StringExpr<E> &expr);
+	explicit String(const StringView &view);
+	// moves take the heap buffer in O(1) and never throw, the source is
+	// left empty (or invalid).  The buffer keeps its allocator: a String
+	// moved out of an arena scope still holds arena memory.
+	String(String &&rval) noexcept;
+	String(StringSumHelper &&rval) noexcept;
 	explicit String(char c);
 	explicit String(unsigned char, unsigned char base=10);
 	explicit String(int, unsigned char base=10);
@@ -80,18 +109,33 @@ public:
 	// return true on success, false on failure (in which case, the string
 	// is left unchanged).  reserve(0), if successful, will validate an
 	// invalid string (i.e., "if (s)" will be true afterwards)
-	unsigned char reserve(unsigned int size);
-	inline unsigned int length(void) const {return len;}
+	unsigned char reserve(size_t size);
+	inline size_t length(void) const {return len;}
+
+	// empties the string but keeps its buffer, so it can be refilled
+	// without reallocating.  an invalid string becomes a valid empty one.
+	void clear(void);
+	// releases unused capacity, moving short contents back to the inline
+	// storage.  returns true on success, false on failure (in which case
+	// the string is left unchanged).
+	unsigned char shrinkToFit(void);
+
+	// allocator of the heap buffer, or the one the next heap buffer will
+	// come from (see StringAllocator.h)
+	StringAllocator &allocator(void) const;
+
+	// snapshot and reset of the process wide buffer growth counters
+	static StringGrowthStats growthStats(void);
+	static void resetGrowthStats(void);
 
 	// creates a copy of the assigned value.  if the value is null or
 	// invalid, or if the memory allocation fails, the string will be
 	// marked as invalid ("if (s)" will be false).
 	String & operator = (const String &rhs);
 	String & operator = (const char *cstr);
-	#ifdef __GXX_EXPERIMENTAL_CXX0X__
-	String & operator = (String &&rval);
-	String & operator = (StringSumHelper &&rval);
-	#endif
+	template <class E> String & operator = (const StringExpr<E> &expr);
+	String & operator = (String &&rval) noexcept;
+	String & operator = (StringSumHelper &&rval) noexcept;
 
 	// concatenate (works w/ built-in types)
 
@@ -106,6 +150,10 @@ public:
 	unsigned char concat(unsigned int num);
 	unsigned char concat(long num);
 	unsigned char concat(unsigned long num);
+	unsigned char concat(const StringView &view) {return concat(view.data(), view.length());}
+	template <class E> unsigned char concat(const StringExpr<E> &expr) {return concatPiece(expr);}
+	// appends an operand of "+" (see StringLeaf) or an expression
+	template <class P> unsigned char concatPiece(const P &piece);
 
 	// if there's not enough memory for the concatenated value, the string
 	// will be left unchanged (but this isn't signalled in any way)
@@ -117,28 +165,13 @@ public:
 	String & operator += (unsigned int num)		{concat(num); return (*this);}
 	String & operator += (long num)			{concat(num); return (*this);}
 	String & operator += (unsigned long num)	{concat(num); return (*this);}
+	String & operator += (const StringView &view)	{concat(view); return (*this);}
+	template <class E>
+	String & operator += (const StringExpr<E> &expr)	{concat(expr); return (*this);}
 
-
-	// Implement StringAdditionOperator per Arduino docs... String + __
-	String operator + (const String &rhs)	{return String(*this) += rhs;}
-	String operator + (const char *cstr)	{return String(*this) += cstr;}
-	String operator + (char c)		{return String(*this) += c;}
-	String operator + (unsigned char num)	{return String(*this) += num;}
-	String operator + (int num)		{return String(*this) += num;}
-	String operator + (unsigned int num)	{return String(*this) += num;}
-	String operator + (long num)		{return String(*this) += num;}
-	String operator + (unsigned long num)	{return String(*this) += num;}
-
-#if 0
-	friend StringSumHelper & operator + (const StringSumHelper &lhs, const String &rhs);
-	friend StringSumHelper & operator + (const StringSumHelper &lhs, const char *cstr);
-	friend StringSumHelper & operator + (const StringSumHelper &lhs, char c);
-	friend StringSumHelper & operator + (const StringSumHelper &lhs, unsigned char num);
-	friend StringSumHelper & operator + (const StringSumHelper &lhs, int num);
-	friend StringSumHelper & operator + (const StringSumHelper &lhs, unsigned int num);
-	friend StringSumHelper & operator + (const StringSumHelper &lhs, long num);
-	friend StringSumHelper & operator + (const StringSumHelper &lhs, unsigned long num);
-#endif
+	// String + __ per Arduino docs is implemented by the lazy
+	// concatenation operators at the end of this file, and by appending
+	// to the buffer when the left side is a temporary String
 
 	// comparison (only works w/ Strings and "strings")
 	operator StringIfHelperType() const { return buffer ? &String::StringIfHelper : 0; }
@@ -149,39 +182,103 @@ public:
 	unsigned char operator == (const char *cstr) const {return equals(cstr);}
 	unsigned char operator != (const String &rhs) const {return !equals(rhs);}
 	unsigned char operator != (const char *cstr) const {return !equals(cstr);}
+	unsigned char equals(const StringView &view) const {return view.equals(this->view());}
+	unsigned char operator == (const StringView &view) const {return equals(view);}
+	unsigned char operator != (const StringView &view) const {return !equals(view);}
 	unsigned char operator <  (const String &rhs) const;
 	unsigned char operator >  (const String &rhs) const;
 	unsigned char operator <= (const String &rhs) const;
 	unsigned char operator >= (const String &rhs) const;
 	unsigned char equalsIgnoreCase(const String &s) const;
 	unsigned char startsWith( const String &prefix) const;
-	unsigned char startsWith(const String &prefix, unsigned int offset) const;
+	unsigned char startsWith(const String &prefix, size_t offset) const;
 	unsigned char endsWith(const String &suffix) const;
+	unsigned char startsWith(const StringView &prefix) const {return view().startsWith(prefix);}
+	unsigned char endsWith(const StringView &suffix) const {return view().endsWith(suffix);}
+
+	// hashing and interning
+	// 64 bit non-cryptographic hash of the contents, the same as
+	// StringView::hash().  Heap buffers cache it until modified, except
+	// those written through operator[], which are hashed every time.
+	uint64_t hash(void) const;
+	// a String sharing the single, process wide, immutable copy of these
+	// contents.  Interned Strings are compared by pointer, and their
+	// storage is kept until the program ends, so intern keys that repeat
+	// (metric names, field names, ...), not arbitrary data.
+	String intern(void) const;
+	bool isInterned(void) const;
+	static size_t internedCount(void);
 
 	// character acccess
-	char charAt(unsigned int index) const;
-	void setCharAt(unsigned int index, char c);
-	char operator [] (unsigned int index) const;
-	char& operator [] (unsigned int index);
-	void getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index=0) const;
-	void toCharArray(char *buf, unsigned int bufsize, unsigned int index=0) const
+	// the non-const operator[] returns a reference into a private buffer:
+	// a shared buffer is duplicated first, and copies made afterwards get
+	// their own buffer instead of sharing it (use charAt() to only read)
+	char charAt(size_t index) const;
+	void setCharAt(size_t index, char c);
+	char operator [] (size_t index) const;
+	char& operator [] (size_t index);
+	void getBytes(unsigned char *buf, size_t bufsize, size_t index=0) const;
+	void toCharArray(char *buf, size_t bufsize, size_t index=0) const
 		{getBytes((unsigned char *)buf, bufsize, index);}
 
-	// search
-	int indexOf( char ch ) const;
-	int indexOf( char ch, unsigned int fromIndex ) const;
-	int indexOf( const String &str ) const;
-	int indexOf( const String &str, unsigned int fromIndex ) const;
-	int lastIndexOf( char ch ) const;
-	int lastIndexOf( char ch, unsigned int fromIndex ) const;
-	int lastIndexOf( const String &str ) const;
-	int lastIndexOf( const String &str, unsigned int fromIndex ) const;
-	String substring( unsigned int beginIndex ) const { return substring(beginIndex, len); };
-	String substring( unsigned int beginIndex, unsigned int endIndex ) const;
+	// search, positions are size_t and results long (-1 if not found),
+	// like StringView
+	long indexOf( char ch ) const;
+	long indexOf( char ch, size_t fromIndex ) const;
+	long indexOf( const String &str ) const;
+	long indexOf( const String &str, size_t fromIndex ) const;
+	long lastIndexOf( char ch ) const;
+	long lastIndexOf( char ch, size_t fromIndex ) const;
+	long lastIndexOf( const String &str ) const;
+	long lastIndexOf( const String &str, size_t fromIndex ) const;
+	long indexOf( const StringView &view ) const {return indexOf(view, 0);}
+	long indexOf( const StringView &view, size_t fromIndex ) const
+		{return this->view().indexOf(view, fromIndex);}
+	// first position of any of the characters of set
+	long indexOfAny( const String &set ) const;
+	long indexOfAny( const String &set, size_t fromIndex ) const;
+	// number of (non overlapping) occurrences
+	size_t count( char ch ) const;
+	size_t count( const String &str ) const;
+	String substring( size_t beginIndex ) const { return substring(beginIndex, len); };
+	String substring( size_t beginIndex, size_t endIndex ) const;
+
+	// views of the contents, no copy: only valid until the String is
+	// modified or destroyed
+	StringView view(void) const {return StringView(buffer, len);}
+	StringView subview( size_t beginIndex ) const {return view().subview(beginIndex);}
+	StringView subview( size_t beginIndex, size_t endIndex ) const {return view().subview(beginIndex, endIndex);}
+
+	// UTF-8.  length(), charAt(), substring() and the other methods count
+	// bytes; these count code points.  isAscii() and isValidUtf8() (no
+	// overlong forms, surrogates or code points above U+10FFFF) are
+	// cached by heap buffers until modified, like hash() (but not for
+	// buffers written through operator[]), so code point indexes of ASCII
+	// strings are O(1) offsets.
+	bool isAscii(void) const;
+	bool isValidUtf8(void) const;
+	size_t utf8Length(void) const;
+	// code point at a code point index, -1 past the end or if malformed
+	long utf8CharAt(size_t index) const;
+	// slices by code point indexes, as substring() and subview()
+	StringView utf8Subview(size_t beginIndex, size_t endIndex) const;
+	StringView utf8Subview(size_t beginIndex) const {return utf8Subview(beginIndex, (size_t)-1);}
+	String utf8Substring(size_t beginIndex, size_t endIndex) const {return String(utf8Subview(beginIndex, endIndex));}
+	String utf8Substring(size_t beginIndex) const {return String(utf8Subview(beginIndex));}
+	// cuts to at most maxBytes bytes without splitting a character
+	void utf8Truncate(size_t maxBytes);
+	StringView utf8Prefix(size_t maxBytes) const {return view().utf8Prefix(maxBytes);}
 
 	// modification
 	void replace(char find, char replace);
 	void replace(const String& find, const String& replace);
+	// replaces several find/replace pairs in a single pass, at each
+	// position the longest find that matches wins (the first in array
+	// order among finds of the same length)
+	void replace(const String *find, const String *replace, unsigned int count);
+	// case conversion and equalsIgnoreCase() work on ASCII letters only,
+	// like the "C" locale, and trim() removes ASCII whitespace; UTF-8
+	// multibyte characters are left as they are
 	void toLowerCase(void);
 	void toUpperCase(void);
 	void trim(void);
@@ -191,22 +288,41 @@ public:
 	char * getCSpec(int base, bool issigned, bool islong);
 
 	char *buffer;	        // the actual char array
-	unsigned int capacity;  // the array length minus one (for the '\0')
-	unsigned int len;       // the String length (not counting the '\0')
-	unsigned char flags;    // unused, for future features
+	size_t capacity;        // the array length minus one (for the '\0')
+	size_t len;             // the String length (not counting the '\0')
+	char sso[STRING_SSO_CAPACITY + 1]; // inline storage for short strings
 
 	const char* c_str() const { return buffer; }
 
-	void init(void);
+	// true if the contents live in the inline storage (no heap buffer)
+	inline bool isInline(void) const {return buffer == sso;}
+	// true if the heap buffer is shared with other copies of this String.
+	// code writing to "buffer" directly must call unshare() first.
+	bool isShared(void) const;
+	unsigned char unshare(void);
+	// to be called after writing to an unshared buffer, drops the cached
+	// hash and UTF-8 class
+	inline void modified(void) {if (buffer && !isInline()) forgetHash(buffer);}
+	static void forgetHash(char *heapbuffer);
+
+	void init(void) {buffer = NULL; capacity = 0; len = 0;}
 	void invalidate(void);
-	unsigned char changeBuffer(unsigned int maxStrLen);
-	unsigned char concat(const char *cstr, unsigned int length);
+	static void releaseHeap(char *heapbuffer);
+	unsigned char changeBuffer(size_t maxStrLen) {return changeBuffer(maxStrLen, maxStrLen);}
+	unsigned char changeBuffer(size_t maxStrLen, size_t minStrLen);
+	unsigned char growBuffer(size_t minStrLen);
+	unsigned char concat(const char *cstr, size_t length);
 
 	// copy and move
-	String & copy(const char *cstr, unsigned int length);
-	#ifdef __GXX_EXPERIMENTAL_CXX0X__
-	void move(String &rhs);
-	#endif
+	String & copy(const char *cstr, size_t length);
+	void move(String &rhs) noexcept;
+};
+
+// Hash functor for String keys in hash containers, for example
+// std::unordered_map<String, int, StringHash>
+struct StringHash
+{
+	size_t operator () (const String &s) const {return (size_t)s.hash();}
 };
 
 class StringSumHelper : public String
@@ -222,5 +338,207 @@ public:
 	StringSumHelper(unsigned long num) : String(num) {}
 };
 
+// Lazy concatenation.  "a + b + c + 1" doesn't build a String at every
+// "+", it builds a small tree of StringSum nodes that is evaluated only
+// when it's converted to a String: the total length (numbers included)
+// is computed first, then every piece is written in place into a single
+// allocation.  Leaves refer to String operands, so an expression must
+// not outlive them (don't keep one in an "auto" variable).
+template <class E>
+class StringExpr
+{
+public:
+	StringExpr() : result(NULL) {}
+	StringExpr(const StringExpr &) : result(NULL) {}
+	~StringExpr() {delete result;}
+
+	// number of characters the expression evaluates to
+	size_t length(void) const {return self().length();}
+	// writes the characters to dst (without '\0'), returns the end
+	char *writeTo(char *dst) const {return self().writeTo(dst);}
+
+	// read-only String access to the result, which is built once and kept
+	// as long as the expression, e.g. for "(a + b).c_str()"
+	const String &str(void) const {if (!result) result = new String(*this); return *result;}
+	const char *c_str(void) const {return str().c_str();}
+	unsigned char equals(const String &s) const {return str().equals(s);}
+	unsigned char equals(const char *cstr) const {return str().equals(cstr);}
+
+private:
+	StringExpr & operator = (const StringExpr &);
+	const E &self(void) const {return static_cast<const E &>(*this);}
+	mutable String *result;
+};
+
+// a String operand, read when the expression is evaluated
+class StringRef
+{
+public:
+	StringRef(const String &s) : str(&s) {}
+	size_t length(void) const {return str->len;}
+	char *writeTo(char *dst) const
+		{if (str->len) memcpy(dst, str->buffer, str->len); return dst + str->len;}
+private:
+	const String *str;
+};
+
+// a C string operand, NULL is taken as ""
+class StringCStr
+{
+public:
+	StringCStr(const char *cstr) : p(cstr), n(cstr ? strlen(cstr) : 0) {}
+	StringCStr(const StringView &view) : p(view.data()), n(view.length()) {}
+	size_t length(void) const {return n;}
+	char *writeTo(char *dst) const {if (n) memcpy(dst, p, n); return dst + n;}
+private:
+	const char *p;
+	size_t n;
+};
+
+// a single character operand
+class StringChar
+{
+public:
+	StringChar(char ch) : c(ch) {}
+	size_t length(void) const {return 1;}
+	char *writeTo(char *dst) const {*dst = c; return dst + 1;}
+private:
+	char c;
+};
+
+// an integer operand, formatted in decimal when the operand is taken
+class StringNumber
+{
+public:
+	StringNumber(int num) {format(num < 0, num < 0 ? 0UL - (unsigned long)num : (unsigned long)num);}
+	StringNumber(unsigned int num) {format(false, num);}
+	StringNumber(long num) {format(num < 0, num < 0 ? 0UL - (unsigned long)num : (unsigned long)num);}
+	StringNumber(unsigned long num) {format(false, num);}
+	size_t length(void) const {return n;}
+	const char *c_str(void) const {return digits + sizeof(digits) - 1 - n;}
+	char *writeTo(char *dst) const {memcpy(dst, c_str(), n); return dst + n;}
+private:
+	void format(bool negative, unsigned long num) {
+		char *p = digits + sizeof(digits) - 1;
+		*p = 0;
+		do {
+			*--p = (char)('0' + num % 10);
+			num /= 10;
+		} while (num);
+		if (negative) *--p = '-';
+		n = (unsigned char)(digits + sizeof(digits) - 1 - p);
+	}
+	char digits[3 * sizeof(unsigned long) + 2];
+	unsigned char n;
+};
+
+// a node concatenating two sub expressions
+template <class L, class R>
+class StringSum : public StringExpr<StringSum<L, R> >
+{
+public:
+	StringSum(const L &l, const R &r) : lhs(l), rhs(r) {}
+	size_t length(void) const {return lhs.length() + rhs.length();}
+	char *writeTo(char *dst) const {return rhs.writeTo(lhs.writeTo(dst));}
+private:
+	L lhs;
+	R rhs;
+};
+
+// maps each operand type accepted by "+" to its leaf type, operands
+// without a mapping are rejected (no "type")
+template <class T> struct StringLeaf {};
+template <> struct StringLeaf<String> {typedef StringRef type;};
+template <> struct StringLeaf<StringSumHelper> {typedef StringRef type;};
+template <> struct StringLeaf<const char *> {typedef StringCStr type;};
+template <> struct StringLeaf<char *> {typedef StringCStr type;};
+template <size_t N> struct StringLeaf<char[N]> {typedef StringCStr type;};
+template <size_t N> struct StringLeaf<const char[N]> {typedef StringCStr type;};
+template <> struct StringLeaf<StringView> {typedef StringCStr type;};
+template <> struct StringLeaf<char> {typedef StringChar type;};
+template <> struct StringLeaf<bool> {typedef StringNumber type;};
+template <> struct StringLeaf<signed char> {typedef StringNumber type;};
+template <> struct StringLeaf<unsigned char> {typedef StringNumber type;};
+template <> struct StringLeaf<short> {typedef StringNumber type;};
+template <> struct StringLeaf<unsigned short> {typedef StringNumber type;};
+template <> struct StringLeaf<int> {typedef StringNumber type;};
+template <> struct StringLeaf<unsigned int> {typedef StringNumber type;};
+template <> struct StringLeaf<long> {typedef StringNumber type;};
+template <> struct StringLeaf<unsigned long> {typedef StringNumber type;};
+template <class L, class R> struct StringLeaf<StringSum<L, R> > {typedef StringSum<L, R> type;};
+
+// String + __
+template <class T>
+inline StringSum<StringRef, typename StringLeaf<T>::type> operator + (const String &lhs, const T &rhs)
+{
+	return StringSum<StringRef, typename StringLeaf<T>::type>(lhs, rhs);
+}
+
+// "string" + String
+inline StringSum<StringCStr, StringRef> operator + (const char *lhs, const String &rhs)
+{
+	return StringSum<StringCStr, StringRef>(lhs, rhs);
+}
+
+// String&& + __ appends to the temporary's own buffer, so a chain
+// started by a temporary ("f() + a + b") grows one buffer in place
+template <class T, class U> struct StringFirst {typedef T type;};
+
+template <class T>
+inline typename StringFirst<String, typename StringLeaf<T>::type>::type operator + (String &&lhs, const T &rhs)
+{
+	lhs.concatPiece(typename StringLeaf<T>::type(rhs));
+	return static_cast<String &&>(lhs);
+}
+
+// (a + b) + __
+template <class E, class T>
+inline StringSum<E, typename StringLeaf<T>::type> operator + (const StringExpr<E> &lhs, const T &rhs)
+{
+	return StringSum<E, typename StringLeaf<T>::type>(static_cast<const E &>(lhs), rhs);
+}
+
+template <class E>
+inline unsigned char operator == (const StringExpr<E> &lhs, const String &rhs) {return lhs.equals(rhs);}
+template <class E>
+inline unsigned char operator == (const StringExpr<E> &lhs, const char *cstr) {return lhs.equals(cstr);}
+template <class E>
+inline unsigned char operator != (const StringExpr<E> &lhs, const String &rhs) {return !lhs.equals(rhs);}
+template <class E>
+inline unsigned char operator != (const StringExpr<E> &lhs, const char *cstr) {return !lhs.equals(cstr);}
+
+template <class E>
+String::String(const StringExpr<E> &expr)
+{
+	init();
+	concat(expr);
+}
+
+template <class E>
+String & String::operator = (const StringExpr<E> &expr)
+{
+	// evaluate first, the expression may refer to this String
+	return *this = String(expr);
+}
+
+template <class P>
+unsigned char String::concatPiece(const P &piece)
+{
+	size_t n = piece.length();
+	if (!buffer) {
+		// a new String gets exactly the size of the result
+		if (!reserve(n)) return 0;
+	} else if (len + n > capacity || isShared()) {
+		if (!growBuffer(len + n)) return 0;
+	}
+	// the pieces read the String operands here, including this one if it
+	// is part of the expression, but only its first len characters
+	piece.writeTo(buffer + len);
+	len += n;
+	buffer[len] = 0;
+	modified();
+	return 1;
+}
+
 #endif  // __cplusplus
 #endif  // String_class_h